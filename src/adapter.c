@@ -0,0 +1,390 @@
+#include "config.h"
+#include "adapter.h"
+#include "macros.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+static const struct {
+  const char *name;
+  const char *field;
+  int type;
+} types[] = {
+  { "text", "", ADAPTER_TEXT },
+  { "jsonl", "text", ADAPTER_JSONL },
+  { "tsv", "1", ADAPTER_TSV },
+  { "xml", "text", ADAPTER_XML },
+};
+
+static const struct {
+  const char *ext;
+  int type;
+} extensions[] = {
+  { ".json", ADAPTER_JSONL },
+  { ".jsonl", ADAPTER_JSONL },
+  { ".ndjson", ADAPTER_JSONL },
+  { ".tsv", ADAPTER_TSV },
+  { ".xml", ADAPTER_XML },
+};
+
+#define len(x) (sizeof (x) / sizeof (x[0]))
+
+static int
+settype (struct adapter *a, int type, const char *field, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < len (types); i++)
+    if (types[i].type == type)
+      break;
+  if (field == NULL) {
+    field = types[i].field;
+    n = strlen (field);
+  }
+  if (n >= sizeof (a->field))
+    return -1;
+  memset (a, 0, sizeof (struct adapter));
+  a->type = type;
+  memcpy (a->field, field, n);
+  if (type == ADAPTER_TSV) {
+    a->column = strtoul (a->field, NULL, 10);
+    if (a->column == 0)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * Initializes the adapter from a spec like "jsonl:text" or "tsv:2". The part
+ * after the colon is optional.
+ */
+int
+adapter_parse (struct adapter *a, const char *spec)
+{
+  const char *c;
+  size_t n;
+  size_t i;
+
+  c = strchr (spec, ':');
+  n = c ? (size_t) (c - spec) : strlen (spec);
+  for (i = 0; i < len (types); i++) {
+    if ((strlen (types[i].name) == n) && (strncasecmp (types[i].name, spec, n) == 0)) {
+      if (c)
+        return settype (a, types[i].type, c + 1, strlen (c + 1));
+      return settype (a, types[i].type, NULL, 0);
+    }
+  }
+  return -1;
+}
+
+static bool
+endswith (const char *s, size_t n, const char *x)
+{
+  const size_t l = strlen (x);
+  return (n >= l) && (strncasecmp (s + n - l, x, l) == 0);
+}
+
+/**
+ * Initializes the adapter for path. Compression suffixes are ignored when
+ * looking at the file extension.
+ */
+int
+adapter_init (struct adapter *a, const char *path)
+{
+  size_t n;
+  size_t i;
+
+  n = strlen (path);
+  if (endswith (path, n, ".gz") || endswith (path, n, ".xz"))
+    n -= 3;
+  else if (endswith (path, n, ".zst"))
+    n -= 4;
+  for (i = 0; i < len (extensions); i++)
+    if (endswith (path, n, extensions[i].ext))
+      return settype (a, extensions[i].type, NULL, 0);
+  return settype (a, ADAPTER_TEXT, NULL, 0);
+}
+
+void
+adapter_reset (struct adapter *a)
+{
+  a->xml.depth = 0;
+  a->xml.tag = false;
+}
+
+static int
+hex (int c)
+{
+  if ((c >= '0') && (c <= '9'))
+    return c - '0';
+  c |= 0x20;
+  if ((c >= 'a') && (c <= 'f'))
+    return c - 'a' + 10;
+  return -1;
+}
+
+/**
+ * Writes the character c as text. Characters beyond ASCII get dropped, since
+ * the scanner drops them anyway. Control characters become spaces.
+ */
+static size_t
+put (char *out, unsigned long c)
+{
+  if (c >= 0x80)
+    return 0;
+  if (c == '\n')
+    *out = '\n';
+  else if (c < ' ')
+    *out = ' ';
+  else
+    *out = (char) c;
+  return 1;
+}
+
+/**
+ * Returns the end of the JSON string starting after the quote at p.
+ */
+static size_t
+jsonend (const char *p, size_t i, size_t n)
+{
+  while (i < n) {
+    if (p[i] == '"')
+      return i;
+    i += (p[i] == '\\') + 1;
+  }
+  return n;
+}
+
+static size_t
+jsonstr (const char *p, size_t i, size_t e, char *out)
+{
+  unsigned long u;
+  size_t j = 0;
+  size_t k;
+  int h;
+
+  while (i < e) {
+    if (p[i] != '\\') {
+      out[j++] = p[i++];
+      continue;
+    }
+    if (++i >= e)
+      break;
+    switch (p[i]) {
+      case 'n':
+        j += put (out + j, '\n');
+        break;
+      case 'b':
+      case 'f':
+      case 'r':
+      case 't':
+        j += put (out + j, ' ');
+        break;
+      case 'u':
+        u = 0;
+        for (k = 1; (k < 5) && (i + k < e) && (h = hex (p[i + k]), h >= 0); k++)
+          u = (u << 4) | (unsigned long) h;
+        j += put (out + j, u);
+        i += k - 1;
+        break;
+      default:
+        out[j++] = p[i];
+        break;
+    }
+    i++;
+  }
+  return j;
+}
+
+static size_t
+extract_jsonl (struct adapter *a, const char *p, size_t n, char *out)
+{
+  const size_t l = strlen (a->field);
+  bool key = false;
+  int depth = 0;
+  size_t i = 0;
+  size_t e;
+
+  while (i < n) {
+    switch (p[i]) {
+      case '{':
+      case '[':
+        key = (++depth == 1) && (p[i] == '{');
+        break;
+      case '}':
+      case ']':
+        depth--;
+        break;
+      case ',':
+        key = (depth == 1);
+        break;
+      case '"':
+        e = jsonend (p, i + 1, n);
+        if ((key) && (e - i - 1 == l) && (memcmp (p + i + 1, a->field, l) == 0)) {
+          /* Skip to the value and extract it, if it's a string. */
+          for (i = e + 1; (i < n) && ((p[i] == ' ') || (p[i] == ':') || (p[i] == '\t')); i++);
+          if ((i < n) && (p[i] == '"'))
+            return jsonstr (p, i + 1, jsonend (p, i + 1, n), out);
+          return 0;
+        }
+        key = false;
+        i = e;
+        break;
+    }
+    i++;
+  }
+  return 0;
+}
+
+static size_t
+extract_tsv (struct adapter *a, const char *p, size_t n, char *out)
+{
+  size_t c = 1;
+  size_t i = 0;
+  size_t j = 0;
+
+  for (; (i < n) && (c < a->column); i++)
+    c += (p[i] == '\t');
+  for (; (i < n) && (p[i] != '\t'); i++) {
+    if ((p[i] != '\\') || (i + 1 >= n)) {
+      out[j++] = p[i];
+      continue;
+    }
+    /* Backslash escapes as written by database exports. */
+    switch (p[++i]) {
+      case 'n':
+        out[j++] = '\n';
+        break;
+      case 'r':
+      case 't':
+        out[j++] = ' ';
+        break;
+      default:
+        out[j++] = p[i];
+        break;
+    }
+  }
+  return j;
+}
+
+static size_t
+entity (const char *p, size_t i, size_t n, char *out, size_t *k)
+{
+  static const struct {
+    const char *name;
+    char c;
+  } named[] = {
+    { "amp", '&' },
+    { "apos", '\'' },
+    { "gt", '>' },
+    { "lt", '<' },
+    { "quot", '"' },
+    { "nbsp", ' ' },
+  };
+  const char *e;
+  unsigned long u;
+  size_t l;
+  size_t x;
+  char *end;
+
+  e = memchr (p + i, ';', min (n - i, 12));
+  if (e == NULL)
+    goto literal;
+  l = (size_t) (e - (p + i)) - 1;
+  *k = l + 2;
+  if ((l > 1) && (p[i + 1] == '#')) {
+    if ((p[i + 2] | 0x20) == 'x')
+      u = strtoul (p + i + 3, &end, 16);
+    else
+      u = strtoul (p + i + 2, &end, 10);
+    if (end != e)
+      goto literal;
+    return put (out, u);
+  }
+  for (x = 0; x < len (named); x++) {
+    if ((strlen (named[x].name) == l) && (memcmp (named[x].name, p + i + 1, l) == 0)) {
+      *out = named[x].c;
+      return 1;
+    }
+  }
+literal:
+  *k = 1;
+  *out = '&';
+  return 1;
+}
+
+static size_t
+extract_xml (struct adapter *a, const char *p, size_t n, char *out)
+{
+  const size_t l = strlen (a->field);
+  const char *gt;
+  size_t b;
+  size_t i = 0;
+  size_t j = 0;
+  size_t k;
+  bool close;
+  bool all = (l == 0);
+
+  while (i < n) {
+    if (a->xml.tag) {
+      gt = memchr (p + i, '>', n - i);
+      if (gt == NULL)
+        break;
+      a->xml.tag = false;
+      i = (size_t) (gt - p) + 1;
+      continue;
+    }
+    if (p[i] == '<') {
+      close = (i + 1 < n) && (p[i + 1] == '/');
+      b = i + 1 + close;
+      for (k = b; (k < n) && (p[k] != '>') && (p[k] != '/') && (p[k] != ' ') && (p[k] != '\t'); k++);
+      gt = memchr (p + k, '>', n - k);
+      if ((!all) && (k - b == l) && (memcmp (p + b, a->field, l) == 0)) {
+        if (close)
+          a->xml.depth -= (a->xml.depth > 0);
+        else if ((gt == NULL) || (gt[-1] != '/'))
+          a->xml.depth++;
+      }
+      /* Markup separates words. */
+      if ((all) || (a->xml.depth > 0))
+        out[j++] = ' ';
+      if (gt == NULL) {
+        a->xml.tag = true;
+        break;
+      }
+      i = (size_t) (gt - p) + 1;
+      continue;
+    }
+    if ((!all) && (a->xml.depth == 0)) {
+      i++;
+      continue;
+    }
+    if (p[i] == '&') {
+      j += entity (p, i, n, out + j, &k);
+      i += k;
+      continue;
+    }
+    out[j++] = p[i++];
+  }
+  return j;
+}
+
+/**
+ * Writes the text of the line p of length n to out, which must hold n
+ * bytes. Returns the length of the text.
+ */
+size_t
+adapter_extract (struct adapter *a, const char *p, size_t n, char *out)
+{
+  switch (a->type) {
+    case ADAPTER_JSONL:
+      return extract_jsonl (a, p, n, out);
+    case ADAPTER_TSV:
+      return extract_tsv (a, p, n, out);
+    case ADAPTER_XML:
+      return extract_xml (a, p, n, out);
+  }
+  memcpy (out, p, n);
+  return n;
+}
@@ -0,0 +1,39 @@
+#ifndef TECTOR_ADAPTER_H
+#define TECTOR_ADAPTER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * Adapter extracts the text of structured input line by line, so that it can
+ * be cleaned and tokenized without writing a plain text copy first.
+ *
+ *  jsonl:FIELD   the string value of FIELD in JSON records, one per line
+ *  tsv:COLUMN    the COLUMN-th column of tab-separated values
+ *  xml:ELEMENT   the character data of ELEMENT with all markup removed
+ *
+ * Newlines in the extracted text start new lines.
+ */
+enum {
+  ADAPTER_TEXT = 0,
+  ADAPTER_JSONL,
+  ADAPTER_TSV,
+  ADAPTER_XML,
+};
+
+struct adapter {
+  int type;
+  size_t column;
+  char field[64];
+  struct {
+    int depth;
+    bool tag;
+  } xml;
+};
+
+int adapter_parse (struct adapter *a, const char *spec);
+int adapter_init (struct adapter *a, const char *path);
+void adapter_reset (struct adapter *a);
+size_t adapter_extract (struct adapter *a, const char *p, size_t n, char *out);
+
+#endif
@@ -3,6 +3,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -55,7 +56,8 @@ bundle_open (const char *path)
 
   /**
    * If a vocab and a model exist, make sure the vocab is older than the model.
-   * Vocabulary changes with existing model aren't supported yet.
+   * A newer vocab changed without bundle_remap, so the rows of the model
+   * don't match its words anymore.
    */
   if (newer (b->path.vocab, b->path.model)) {
     warning ("newer");
@@ -101,3 +103,39 @@ bundle_save (struct bundle *b)
     return vocab_save (b->vocab, b->path.vocab);
   return 0;
 }
+
+/**
+ * Saves the vocab of b after it changed, and moves the rows of the model to
+ * the new word ids. The old vocab gets mapped from its file before the new
+ * one replaces it. The vocab gets saved first, so if saving the model fails,
+ * bundle_open refuses the mismatch.
+ */
+int
+bundle_remap (struct bundle *b)
+{
+  struct vocab *old;
+  size_t *map = NULL;
+  size_t i;
+  int r = -1;
+
+  if (b->model == NULL)
+    return vocab_save (b->vocab, b->path.vocab);
+  old = vocab_open (b->path.vocab);
+  if (old == NULL)
+    return -1;
+  if (vocab_save (b->vocab, b->path.vocab) != 0)
+    goto cleanup;
+  map = mem_alloc (b->vocab->len + 1, sizeof (size_t));
+  if (map == NULL)
+    goto cleanup;
+  for (i = 0; i < b->vocab->len; i++)
+    if (vocab_find (old, vocab_word (b->vocab, i), &map[i]) != 0)
+      map[i] = SIZE_MAX;
+  if (model_remap (b->model, map, b->vocab->len) != 0)
+    goto cleanup;
+  r = model_save (b->model, b->path.model);
+cleanup:
+  mem_free (map);
+  vocab_free (old);
+  return r;
+}
@@ -23,5 +23,6 @@ struct bundle {
 struct bundle *bundle_open (const char *);
 void bundle_free (struct bundle *);
 int bundle_save (struct bundle *);
+int bundle_remap (struct bundle *);
 
 #endif
@@ -0,0 +1,88 @@
+#include "config.h"
+#include "classify.h"
+#include "string.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(HAVE_AVX2)
+#include <immintrin.h>
+#endif
+
+uint64_t
+classify_scalar (const unsigned char *p, size_t n)
+{
+  uint64_t m = 0;
+  size_t k;
+
+  for (k = 0; k < n; k++)
+    if (isunicode (p[k]) || isspace (p[k]))
+      m |= 1ull << k;
+  return m;
+}
+
+#if defined(__SSE2__)
+uint64_t
+classify_sse2 (const unsigned char *p)
+{
+  const __m128i lim = _mm_set1_epi8 (' ' + 1);
+  const __m128i del = _mm_set1_epi8 (127);
+  uint64_t m = 0;
+  __m128i x;
+  int k;
+
+  for (k = 0; k < CLASSIFY_BLOCK; k += 16) {
+    x = _mm_loadu_si128 ((const __m128i *) (p + k));
+    x = _mm_or_si128 (_mm_cmplt_epi8 (x, lim), _mm_cmpeq_epi8 (x, del));
+    m |= (uint64_t) (uint16_t) _mm_movemask_epi8 (x) << k;
+  }
+  return m;
+}
+#endif
+
+#if defined(HAVE_AVX2)
+__attribute__ ((target ("avx2")))
+uint64_t
+classify_avx2 (const unsigned char *p)
+{
+  const __m256i lim = _mm256_set1_epi8 (' ' + 1);
+  const __m256i del = _mm256_set1_epi8 (127);
+  uint64_t m = 0;
+  __m256i x;
+  int k;
+
+  for (k = 0; k < CLASSIFY_BLOCK; k += 32) {
+    x = _mm256_loadu_si256 ((const __m256i *) (p + k));
+    x = _mm256_or_si256 (_mm256_cmpgt_epi8 (lim, x), _mm256_cmpeq_epi8 (x, del));
+    m |= (uint64_t) (uint32_t) _mm256_movemask_epi8 (x) << k;
+  }
+  return m;
+}
+#endif
+
+static uint64_t
+classify_block (const unsigned char *p)
+{
+  return classify_scalar (p, CLASSIFY_BLOCK);
+}
+
+uint64_t (*classify) (const unsigned char *p) = classify_block;
+
+/**
+ * Picks the classify function before main runs, so that threads never race
+ * on it.
+ */
+__attribute__ ((constructor))
+static void
+classify_init (void)
+{
+#if defined(__SSE2__)
+  classify = classify_sse2;
+#endif
+#if defined(HAVE_AVX2)
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    classify = classify_avx2;
+#endif
+}
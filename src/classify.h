@@ -0,0 +1,30 @@
+#ifndef TECTOR_CLASSIFY_H
+#define TECTOR_CLASSIFY_H
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define CLASSIFY_BLOCK 64
+
+/**
+ * The classify functions return a bitmask of the bytes in a block that need
+ * special treatment, i.e. whitespace and non-ASCII characters. Everything else
+ * gets copied as is. Interpreted as signed char, both classes are <= ' ',
+ * except for DEL.
+ *
+ * The vector versions take whole blocks of CLASSIFY_BLOCK bytes, classify
+ * picks the fastest one the CPU supports once at startup.
+ */
+uint64_t classify_scalar (const unsigned char *p, size_t n);
+#if defined(__SSE2__)
+uint64_t classify_sse2 (const unsigned char *p);
+#endif
+#if defined(HAVE_AVX2)
+uint64_t classify_avx2 (const unsigned char *p);
+#endif
+
+extern uint64_t (*classify) (const unsigned char *p);
+
+#endif
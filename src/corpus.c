@@ -3,6 +3,8 @@
 #include "log.h"
 #include "mem.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #define resize(c,f,s) \
@@ -99,50 +101,113 @@ resize_sentences (struct corpus *c, size_t cap)
 }
 
 static int
-add_sentence (struct corpus *c, char *s)
+begin_sentence (struct corpus *c)
 {
-  size_t n = 0;
-  size_t x = 0;
-  char *w;
-
   /**
    * The order of these appends is crucial - the other way around might produce
    * a dangling pointer if words get resized.
    */
   append (c, words, 0);
   append (c, sentences, (struct sentence *) (c->words.ptr + c->words.len - 1));
+  return 0;
+}
+
+static int
+add_word (struct corpus *c, size_t x)
+{
+  append (c, words, x);
+  c->sentences.ptr[c->sentences.len - 1]->len++;
+  return 0;
+}
+
+static int
+end_sentence (struct corpus *c)
+{
+  const size_t n = c->sentences.ptr[c->sentences.len - 1]->len;
 
-  while (w = strtok_r (s, " ", &s), w) {
-    if (vocab_find (c->vocab, w, &x) != 0)
-      continue;
-    append (c, words, x);
-    n++;
-  }
   if (n <= 1) {
     c->words.len -= 1 + n;
     c->sentences.len--;
   }
-  else {
-    c->sentences.ptr[c->sentences.len - 1]->len = n;
-  }
   return 0;
 }
 
+/**
+ * Reads sentences from s until the corpus holds n sentences. Returns 0 if the
+ * corpus is full, 1 at the end of the input and -1 on errors. Calling it
+ * again continues with the next sentence, so long inputs can be processed in
+ * blocks of constant size.
+ */
+int
+corpus_read (struct corpus *c, struct scanner *s, size_t n)
+{
+  const char *w;
+  size_t l;
+  size_t x;
+  bool open = false;
+  int r;
+
+  while (r = scanner_next_token (s, &w, &l), r >= 0) {
+    if (!open) {
+      if (begin_sentence (c) != 0)
+        return -1;
+      open = true;
+    }
+    if (r == 0) {
+      if (vocab_findn (c->vocab, w, l, &x) != 0)
+        continue;
+      if (add_word (c, x) != 0)
+        return -1;
+    }
+    else {
+      end_sentence (c);
+      open = false;
+      if (c->sentences.len >= n)
+        return 0;
+    }
+  }
+  if (open)
+    end_sentence (c);
+  return (r == -1) ? 1 : -1;
+}
+
+/**
+ * Reads sentences from the shard s like corpus_read reads them from a
+ * scanner. The ids are checked against the vocab, but need no lookup.
+ */
+int
+corpus_readshard (struct corpus *c, struct shard *s, size_t n)
+{
+  size_t l;
+  size_t x;
+  int r;
+
+  while (r = shard_read (s, &l), r == 0) {
+    if (begin_sentence (c) != 0)
+      return -1;
+    while (l--) {
+      if ((shard_read (s, &x) != 0) || (x >= c->vocab->len))
+        return -1;
+      if (add_word (c, x) != 0)
+        return -1;
+    }
+    end_sentence (c);
+    if (c->sentences.len >= n)
+      return 0;
+  }
+  return r;
+}
+
 int
 corpus_parse (struct corpus *c, const char *path)
 {
   struct scanner *s;
-  char b[8192] = { 0 };
+  int r;
 
-  s = scanner_open (path);
+  s = scanner_open (path, NULL);
   if (s == NULL)
     return -1;
-
-  while (scanner_readline (s, b, sizeof (b)) >= 0) {
-    if (*b)
-      if (add_sentence (c, b) != 0)
-        return -1;
-  }
+  r = corpus_read (c, s, SIZE_MAX);
   scanner_free (s);
-  return 0;
+  return -(r < 0);
 }
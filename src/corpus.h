@@ -2,6 +2,8 @@
 #define TECTOR_CORPUS_H
 
 #include <stdlib.h>
+#include "scanner.h"
+#include "shard.h"
 #include "vocab.h"
 
 struct sentence {
@@ -29,6 +31,8 @@ void corpus_free (struct corpus *c);
 int corpus_alloc (struct corpus *c);
 int corpus_build (struct corpus *c);
 int corpus_clear (struct corpus *c);
+int corpus_read (struct corpus *c, struct scanner *s, size_t n);
+int corpus_readshard (struct corpus *c, struct shard *s, size_t n);
 int corpus_parse (struct corpus *c, const char *path);
 
 #endif
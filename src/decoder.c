@@ -0,0 +1,469 @@
+#include "config.h"
+#include "decoder.h"
+#include "macros.h"
+#include "mem.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define WITH_GZIP 1
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+#define WITH_XZ 1
+#include <lzma.h>
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define WITH_ZSTD 1
+#include <zstd.h>
+#endif
+
+#define DECODER_DEPTH 4
+#define DECODER_SIZE (1 << 20)
+
+enum {
+  FORMAT_GZIP,
+  FORMAT_XZ,
+  FORMAT_ZSTD,
+  NUM_FORMATS,
+};
+
+struct decoder {
+  int fd;
+  int format;
+  int error;
+  bool stop;
+  bool done;
+  /**
+   * Whether the last stream of the input is complete, only touched by the
+   * thread.
+   */
+  bool ended;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /**
+   * Number of buffers produced by the thread and consumed by the reader.
+   * Buffers with an index in [tail,head[ belong to the reader.
+   */
+  size_t head;
+  size_t tail;
+  size_t pos;
+  struct {
+    unsigned char *data;
+    size_t len;
+  } buffers[DECODER_DEPTH];
+  /**
+   * Compressed input, only touched by the thread.
+   */
+  struct {
+    unsigned char *data;
+    size_t len;
+    size_t pos;
+    bool eof;
+  } in;
+  union {
+#if defined(WITH_GZIP)
+    z_stream gzip;
+#endif
+#if defined(WITH_XZ)
+    lzma_stream xz;
+#endif
+#if defined(WITH_ZSTD)
+    ZSTD_DStream *zstd;
+#endif
+    int none;
+  } stream;
+};
+
+/**
+ * The step functions decompress as much of the input as possible into out
+ * and advance d->in.pos and *len accordingly. They set d->ended when a stream
+ * ends and clear it once input of the next one gets consumed. They return -1
+ * on errors.
+ */
+typedef int (*step_fn) (struct decoder *d, unsigned char *out, size_t *len, size_t cap);
+
+/**
+ * Updates d->ended after a step that consumed the input up to pos.
+ */
+static inline void
+track (struct decoder *d, size_t pos, bool end)
+{
+  if (end)
+    d->ended = true;
+  else if (pos > d->in.pos)
+    d->ended = false;
+}
+
+#if defined(WITH_GZIP)
+static int
+step_gzip (struct decoder *d, unsigned char *out, size_t *len, size_t cap)
+{
+  z_stream *z = &d->stream.gzip;
+  int r;
+
+  z->next_in = d->in.data + d->in.pos;
+  z->avail_in = (uInt) (d->in.len - d->in.pos);
+  z->next_out = out + *len;
+  z->avail_out = (uInt) (cap - *len);
+  r = inflate (z, Z_NO_FLUSH);
+  track (d, d->in.len - z->avail_in, r == Z_STREAM_END);
+  d->in.pos = d->in.len - z->avail_in;
+  *len = cap - z->avail_out;
+  /* Files can contain several gzip members. */
+  if (r == Z_STREAM_END)
+    return -(inflateReset (z) != Z_OK);
+  return -((r != Z_OK) && (r != Z_BUF_ERROR));
+}
+#endif
+
+#if defined(WITH_XZ)
+static int
+step_xz (struct decoder *d, unsigned char *out, size_t *len, size_t cap)
+{
+  lzma_stream *z = &d->stream.xz;
+  lzma_ret r;
+
+  z->next_in = d->in.data + d->in.pos;
+  z->avail_in = d->in.len - d->in.pos;
+  z->next_out = out + *len;
+  z->avail_out = cap - *len;
+  r = lzma_code (z, d->in.eof ? LZMA_FINISH : LZMA_RUN);
+  track (d, d->in.len - z->avail_in, r == LZMA_STREAM_END);
+  d->in.pos = d->in.len - z->avail_in;
+  *len = cap - z->avail_out;
+  return -((r != LZMA_OK) && (r != LZMA_STREAM_END) && (r != LZMA_BUF_ERROR));
+}
+#endif
+
+#if defined(WITH_ZSTD)
+static int
+step_zstd (struct decoder *d, unsigned char *out, size_t *len, size_t cap)
+{
+  ZSTD_inBuffer i = { d->in.data, d->in.len, d->in.pos };
+  ZSTD_outBuffer o = { out, cap, *len };
+  size_t r;
+
+  r = ZSTD_decompressStream (d->stream.zstd, &o, &i);
+  track (d, i.pos, r == 0);
+  d->in.pos = i.pos;
+  *len = o.pos;
+  return -(ZSTD_isError (r) != 0);
+}
+#endif
+
+static const step_fn steps[NUM_FORMATS] = {
+#if defined(WITH_GZIP)
+  [FORMAT_GZIP] = step_gzip,
+#endif
+#if defined(WITH_XZ)
+  [FORMAT_XZ] = step_xz,
+#endif
+#if defined(WITH_ZSTD)
+  [FORMAT_ZSTD] = step_zstd,
+#endif
+};
+
+static int
+init (struct decoder *d)
+{
+  switch (d->format) {
+#if defined(WITH_GZIP)
+    case FORMAT_GZIP:
+      /* 32 enables automatic header detection. */
+      return -(inflateInit2 (&d->stream.gzip, 15 + 32) != Z_OK);
+#endif
+#if defined(WITH_XZ)
+    case FORMAT_XZ:
+      d->stream.xz = (lzma_stream) LZMA_STREAM_INIT;
+      return -(lzma_stream_decoder (&d->stream.xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK);
+#endif
+#if defined(WITH_ZSTD)
+    case FORMAT_ZSTD:
+      d->stream.zstd = ZSTD_createDStream ();
+      return -(d->stream.zstd == NULL);
+#endif
+  }
+  return -1;
+}
+
+static void
+end (struct decoder *d)
+{
+  switch (d->format) {
+#if defined(WITH_GZIP)
+    case FORMAT_GZIP:
+      inflateEnd (&d->stream.gzip);
+      break;
+#endif
+#if defined(WITH_XZ)
+    case FORMAT_XZ:
+      lzma_end (&d->stream.xz);
+      break;
+#endif
+#if defined(WITH_ZSTD)
+    case FORMAT_ZSTD:
+      ZSTD_freeDStream (d->stream.zstd);
+      break;
+#endif
+  }
+}
+
+static int
+refill (struct decoder *d)
+{
+  ssize_t r;
+
+  for (;;) {
+    if (r = read (d->fd, d->in.data, DECODER_SIZE), r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    break;
+  }
+  d->in.len = (size_t) r;
+  d->in.pos = 0;
+  d->in.eof = (r == 0);
+  return 0;
+}
+
+/**
+ * Fills a buffer with decompressed data. The buffer is only partially filled
+ * at the end of the input. Returns 1 once nothing is left, or -1 if the input
+ * ends in the middle of a stream.
+ */
+static int
+fill (struct decoder *d, unsigned char *out, size_t *len)
+{
+  size_t p;
+  size_t l;
+
+  *len = 0;
+  while (*len < DECODER_SIZE) {
+    if ((d->in.pos == d->in.len) && (!d->in.eof))
+      if (refill (d) != 0)
+        return -1;
+    p = d->in.pos;
+    l = *len;
+    if (steps[d->format] (d, out, len, DECODER_SIZE) != 0) {
+      errno = EIO;
+      return -1;
+    }
+    /* No progress at the end of the input means we're done. */
+    if ((d->in.eof) && (p == d->in.pos) && (l == *len)) {
+      if (!d->ended) {
+        errno = EIO;
+        return -1;
+      }
+      return (*len == 0);
+    }
+  }
+  return 0;
+}
+
+static void *
+run (void *arg)
+{
+  struct decoder *d = arg;
+  size_t len;
+  size_t i;
+  int r;
+
+  for (;;) {
+    pthread_mutex_lock (&d->lock);
+    while ((d->head - d->tail == DECODER_DEPTH) && (!d->stop))
+      pthread_cond_wait (&d->cond, &d->lock);
+    i = d->head % DECODER_DEPTH;
+    r = d->stop;
+    pthread_mutex_unlock (&d->lock);
+    if (r)
+      break;
+
+    r = fill (d, d->buffers[i].data, &len);
+
+    pthread_mutex_lock (&d->lock);
+    d->buffers[i].len = len;
+    if (len > 0)
+      d->head++;
+    if (r != 0) {
+      d->error = (r < 0) ? errno : 0;
+      d->done = true;
+    }
+    pthread_cond_broadcast (&d->cond);
+    pthread_mutex_unlock (&d->lock);
+    if (r != 0)
+      break;
+  }
+  return NULL;
+}
+
+/**
+ * Magic numbers that compressed streams start with.
+ */
+static const struct {
+  const char *ptr;
+  size_t len;
+} magics[NUM_FORMATS] = {
+  [FORMAT_GZIP] = { "\x1f\x8b", 2 },
+  [FORMAT_XZ] = { "\xfd" "7zXZ\0", 6 },
+  [FORMAT_ZSTD] = { "\x28\xb5\x2f\xfd", 4 },
+};
+
+/**
+ * Returns the supported format whose magic number starts the n bytes at m,
+ * or -1 if there is none.
+ */
+static int
+format (const unsigned char *m, size_t n)
+{
+  int f;
+
+  for (f = 0; f < NUM_FORMATS; f++)
+    if ((steps[f]) && (n >= magics[f].len) && (memcmp (m, magics[f].ptr, magics[f].len) == 0))
+      return f;
+  return -1;
+}
+
+/**
+ * Returns true if the n bytes at p start a stream that a decoder can
+ * decompress.
+ */
+bool
+decoder_detect (const void *p, size_t n)
+{
+  return format (p, n) >= 0;
+}
+
+/**
+ * Returns true if the n bytes at p are too short to tell, because they are
+ * the beginning of a magic number. Callers that read the input in pieces
+ * should read on before calling decoder_detect.
+ */
+bool
+decoder_partial (const void *p, size_t n)
+{
+  int f;
+
+  for (f = 0; f < NUM_FORMATS; f++)
+    if ((steps[f]) && (n < magics[f].len) && (memcmp (p, magics[f].ptr, n) == 0))
+      return true;
+  return false;
+}
+
+/**
+ * Returns a decoder for fd or NULL if the input isn't compressed in a
+ * supported format. The n bytes at head are the start of the input, which the
+ * caller already read from fd, so the format is told from them and fd never
+ * has to seek. That way, pipes work just like files.
+ */
+struct decoder *
+decoder_new (int fd, const void *head, size_t n)
+{
+  struct decoder *d;
+  size_t i;
+  int f;
+
+  f = format (head, n);
+  if (f < 0)
+    return NULL;
+
+  d = mem_alloc (1, sizeof (struct decoder));
+  if (d == NULL)
+    return NULL;
+  d->fd = fd;
+  d->format = f;
+  d->in.data = mem_alloc (max (n, (size_t) DECODER_SIZE), 1);
+  if (d->in.data == NULL)
+    goto error;
+  memcpy (d->in.data, head, n);
+  d->in.len = n;
+  for (i = 0; i < DECODER_DEPTH; i++) {
+    d->buffers[i].data = mem_alloc (DECODER_SIZE, 1);
+    if (d->buffers[i].data == NULL)
+      goto error;
+  }
+  if (init (d) != 0)
+    goto error;
+  pthread_mutex_init (&d->lock, NULL);
+  pthread_cond_init (&d->cond, NULL);
+  if (pthread_create (&d->thread, NULL, run, d) != 0) {
+    pthread_cond_destroy (&d->cond);
+    pthread_mutex_destroy (&d->lock);
+    end (d);
+    goto error;
+  }
+  return d;
+error:
+  for (i = 0; i < DECODER_DEPTH; i++)
+    if (d->buffers[i].data)
+      mem_free (d->buffers[i].data);
+  if (d->in.data)
+    mem_free (d->in.data);
+  mem_free (d);
+  return NULL;
+}
+
+void
+decoder_free (struct decoder *d)
+{
+  size_t i;
+
+  pthread_mutex_lock (&d->lock);
+  d->stop = true;
+  pthread_cond_broadcast (&d->cond);
+  pthread_mutex_unlock (&d->lock);
+  pthread_join (d->thread, NULL);
+  pthread_cond_destroy (&d->cond);
+  pthread_mutex_destroy (&d->lock);
+  end (d);
+  for (i = 0; i < DECODER_DEPTH; i++)
+    mem_free (d->buffers[i].data);
+  mem_free (d->in.data);
+  mem_free (d);
+}
+
+/**
+ * Works like read(2). Copies data of the oldest decompressed buffer to buf,
+ * and hands the buffer back to the thread once it's consumed.
+ */
+ssize_t
+decoder_read (struct decoder *d, void *buf, size_t n)
+{
+  size_t i;
+  size_t l;
+
+  pthread_mutex_lock (&d->lock);
+  while ((d->tail == d->head) && (!d->done))
+    pthread_cond_wait (&d->cond, &d->lock);
+  if (d->tail == d->head) {
+    pthread_mutex_unlock (&d->lock);
+    if (d->error) {
+      errno = d->error;
+      return -1;
+    }
+    return 0;
+  }
+  i = d->tail % DECODER_DEPTH;
+  pthread_mutex_unlock (&d->lock);
+
+  l = min (n, d->buffers[i].len - d->pos);
+  memcpy (buf, d->buffers[i].data + d->pos, l);
+  d->pos += l;
+  if (d->pos == d->buffers[i].len) {
+    pthread_mutex_lock (&d->lock);
+    d->tail++;
+    d->pos = 0;
+    pthread_cond_broadcast (&d->cond);
+    pthread_mutex_unlock (&d->lock);
+  }
+  return (ssize_t) l;
+}
@@ -0,0 +1,22 @@
+#ifndef TECTOR_DECODER_H
+#define TECTOR_DECODER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * Decoder decompresses gzip, xz and zstd files. Decompression happens in a
+ * background thread that fills a ring of buffers, so it overlaps with
+ * whatever the caller does with the data.
+ */
+struct decoder;
+
+bool decoder_detect (const void *p, size_t n);
+bool decoder_partial (const void *p, size_t n);
+struct decoder *decoder_new (int fd, const void *head, size_t n);
+void decoder_free (struct decoder *d);
+
+ssize_t decoder_read (struct decoder *d, void *buf, size_t n);
+
+#endif
@@ -0,0 +1,175 @@
+#include "config.h"
+#include "dedup.h"
+#include "log.h"
+#include "mem.h"
+#include "string.h"
+
+/**
+ * Signatures consist of DEDUP_BANDS bands of DEDUP_ROWS minimums each. Two
+ * lines share a band with high probability once the Jaccard similarity of
+ * their bigrams exceeds (1 / DEDUP_BANDS) ^ (1 / DEDUP_ROWS), i.e. about 0.7.
+ */
+#define DEDUP_BANDS 4
+#define DEDUP_ROWS 4
+#define DEDUP_HASHES (DEDUP_BANDS * DEDUP_ROWS)
+
+/**
+ * Lines with fewer words only get checked for exact duplicates, since a few
+ * changed words make all the difference.
+ */
+#define DEDUP_MIN_WORDS 6
+
+/**
+ * Number of slots probed before a key replaces an old one.
+ */
+#define DEDUP_PROBES 8
+
+static inline uint64_t
+mix (uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+/**
+ * Returns a table of at most size bytes.
+ */
+struct dedup *
+dedup_new (size_t size)
+{
+  struct dedup *d;
+  size_t n = 1024;
+
+  while ((n << 1) * sizeof (uint64_t) <= size)
+    n <<= 1;
+  d = mem_alloc (1, sizeof (struct dedup));
+  if (d == NULL)
+    return NULL;
+  d->slots = mem_alloc (n, sizeof (uint64_t));
+  if (d->slots == NULL) {
+    mem_free (d);
+    return NULL;
+  }
+  d->mask = n - 1;
+  return d;
+}
+
+void
+dedup_free (struct dedup *d)
+{
+  mem_free (d->slots);
+  mem_free (d);
+}
+
+/**
+ * Returns true if key is in the table and adds it otherwise. Zero marks
+ * empty slots, so it can't be a key.
+ */
+static bool
+lookup (struct dedup *d, uint64_t key)
+{
+  uint64_t *slot;
+  uint64_t v;
+  size_t i;
+
+  key |= (key == 0);
+  for (i = 0; i < DEDUP_PROBES; i++) {
+    slot = &d->slots[(key + i) & d->mask];
+    v = __atomic_load_n (slot, __ATOMIC_RELAXED);
+    if ((v == 0) && (__atomic_compare_exchange_n (slot, &v, key, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)))
+      return false;
+    /* Either the slot was taken or somebody else was faster. */
+    if (v == key)
+      return true;
+  }
+  __atomic_store_n (&d->slots[(key + (key >> 61)) & d->mask], key, __ATOMIC_RELAXED);
+  return false;
+}
+
+/**
+ * Returns true if the line p of length n duplicates an earlier line. Words
+ * are separated by whitespace and their non-ASCII bytes get ignored, the same
+ * way the scanner splits lines into words.
+ */
+bool
+dedup_check (struct dedup *d, const char *p, size_t n)
+{
+  static const uint64_t seeds[DEDUP_HASHES] = {
+    0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull, 0x2545f4914f6cdd1dull,
+    0x632be59bd9b4e019ull, 0x85ebca77c2b2ae63ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull,
+    0xd6e8feb86659fd93ull, 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull,
+    0x589965cc75374cc3ull, 0x1d8e4e27c47d124full, 0xff51afd7ed558ccdull, 0xc4ceb9fe1a85ec53ull,
+  };
+  uint64_t sig[DEDUP_HASHES];
+  uint64_t fp = 0;
+  uint64_t prev = 0;
+  uint64_t w;
+  uint64_t s;
+  uint64_t v;
+  size_t words = 0;
+  size_t i = 0;
+  size_t k;
+  bool near = false;
+
+  for (k = 0; k < DEDUP_HASHES; k++)
+    sig[k] = UINT64_MAX;
+
+  while (i < n) {
+    while ((i < n) && isspace ((unsigned char) p[i]))
+      i++;
+    if (i == n)
+      break;
+    w = 14695981039346656037ull;
+    for (; (i < n) && !isspace ((unsigned char) p[i]); i++)
+      if (!isunicode ((unsigned char) p[i]))
+        w = (w ^ (uint8_t) p[i]) * 1099511628211ull;
+    if (w == 14695981039346656037ull)
+      continue;
+    fp = mix (fp ^ w);
+    /* The first word forms a bigram with the line start. */
+    s = mix (prev * 31 + w);
+    for (k = 0; k < DEDUP_HASHES; k++) {
+      v = (s ^ seeds[k]) * 0x9e3779b97f4a7c15ull;
+      if (v < sig[k])
+        sig[k] = v;
+    }
+    prev = w;
+    words++;
+  }
+  if (words == 0)
+    return false;
+
+  __atomic_add_fetch (&d->seen.lines, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&d->seen.words, words, __ATOMIC_RELAXED);
+  if (lookup (d, fp)) {
+    __atomic_add_fetch (&d->removed.exact, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&d->removed.words, words, __ATOMIC_RELAXED);
+    return true;
+  }
+  if (words < DEDUP_MIN_WORDS)
+    return false;
+  for (k = 0; k < DEDUP_HASHES; k += DEDUP_ROWS) {
+    s = mix (k + 1);
+    for (i = 0; i < DEDUP_ROWS; i++)
+      s = mix (s ^ sig[k + i]);
+    near |= lookup (d, s);
+  }
+  if (near) {
+    __atomic_add_fetch (&d->removed.near, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&d->removed.words, words, __ATOMIC_RELAXED);
+  }
+  return near;
+}
+
+void
+dedup_report (struct dedup *d)
+{
+  const size_t lines = d->removed.exact + d->removed.near;
+
+  info ("dedup removed %zu of %zu lines (%zu exact, %zu near) and %zu of %zu words",
+      lines, d->seen.lines, d->removed.exact, d->removed.near, d->removed.words, d->seen.words);
+}
@@ -0,0 +1,42 @@
+#ifndef TECTOR_DEDUP_H
+#define TECTOR_DEDUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Dedup detects lines that were seen before. Exact duplicates are found by a
+ * 64-bit fingerprint of their words, near duplicates by MinHash signatures
+ * of their word bigrams, split into bands for locality-sensitive hashing.
+ *
+ * Fingerprints and band keys share a fixed-size table, so memory stays
+ * bounded. Once the table fills up, old keys get overwritten, which only
+ * lets some duplicates slip through. The table can be shared by threads.
+ * Threads race to insert, though, so which lines get removed then depends
+ * on timing.
+ */
+struct dedup {
+  size_t mask;
+  uint64_t *slots;
+  /**
+   * Lines and words checked and removed so far.
+   */
+  struct {
+    size_t lines;
+    size_t words;
+  } seen;
+  struct {
+    size_t exact;
+    size_t near;
+    size_t words;
+  } removed;
+};
+
+struct dedup *dedup_new (size_t size);
+void dedup_free (struct dedup *d);
+
+bool dedup_check (struct dedup *d, const char *p, size_t n);
+void dedup_report (struct dedup *d);
+
+#endif
@@ -1,40 +1,46 @@
 #include "config.h"
 #include "filter.h"
 #include "stopwords.h"
-#include "stem.h"
+#include "stemcache.h"
 #include "string.h"
 
 #include <stdbool.h>
 #include <string.h>
 
 /**
- * Cleans and filters a word. This function can work in-place.
- * The filtered word will never exceed the unfiltered word, so no
- * buffer overflows.
+ * Cleans and filters the word of length n at src. This function can work
+ * in-place. The filtered word will never exceed the unfiltered word, but dst
+ * needs room for the null-terminator. Words split at dashes are separated by
+ * a single space, the result never starts or ends with a space.
  */
-static size_t
-filterword (char *dst, const char *restrict src)
+size_t
+filterword (char *dst, const char *src, size_t n)
 {
   bool split = false;
-  int i = 0;
-  int j = 0;
-  int mask = 0;
+  bool mixed = false;
+  size_t i = 0;
+  size_t j = 0;
+  size_t k;
+  char first = 0;
+  char c;
 
   /**
    * First write the characters from src to dst. Filter everything that isn't
-   * part of the Latin alphabet [a-z]. Also keep track of what letters were read
-   * in the bitmask mask.
+   * part of the Latin alphabet [a-z]. Also keep track of whether the letters
+   * differ from the first one.
    */
-  while (src[i] != '\0') {
+  while (i < n) {
     /* Split words at dashes. */
     if (src[i] == '-') {
       split = true;
       break;
     }
-    if (isalpha (src[i])) {
-      dst[j] = lowercase (src[i]);
-      mask |= 1 << ordalpha (dst[j]);
-      j++;
+    c = lowercasealpha (src[i]);
+    if (c) {
+      if (j == 0)
+        first = c;
+      mixed |= (c != first);
+      dst[j++] = c;
     }
     i++;
   }
@@ -54,25 +60,25 @@ filterword (char *dst, const char *restrict src)
     j = 0;
 
   /**
-   * Ignore the word if it consists of a single letter only (e.g. "aaaaa"),
-   * this means only 1 bit in mask is set.
+   * Ignore the word if it consists of a single letter only (e.g. "aaaaa").
    */
-  if ((mask & (mask - 1)) == 0)
+  if (!mixed)
     j = 0;
 
   /**
    * Ignore the word if it is a stopword.
    */
   if (j > 0) {
-    if (isstopword (dst))
+    if (isstopword (dst, j))
       j = 0;
   }
 
   /**
-   * Stem the word. Ignore it if the stemmed word has less than 2 characters.
+   * Stem the word, asking the cache first. Ignore it if the stemmed word has
+   * less than 2 characters.
    */
   if (j > 0) {
-    if (j = stem (dst), j < 2)
+    if (j = stemcache_stem (dst, j), j < 2)
       j = 0;
   }
 
@@ -83,11 +89,51 @@ filterword (char *dst, const char *restrict src)
   if (split) {
     if (j > 0)
       dst[j++] = ' ';
-    j += filterword (dst + j, src + i + 1);
+    k = filterword (dst + j, src + i + 1, n - i - 1);
+    if ((k == 0) && (j > 0))
+      dst[--j] = '\0';
+    j += k;
   }
   return j;
 }
 
+/**
+ * Filters the words of the line src of length n and writes them to dst,
+ * followed by a newline. Non-ASCII characters are dropped before filtering.
+ * Returns the length written, which is 0 if no word survived. dst needs room
+ * for n + 2 bytes and must not overlap src.
+ */
+size_t
+filterline (char *restrict dst, const char *restrict src, size_t n)
+{
+  size_t len = 0;
+  size_t b;
+  size_t i = 0;
+  size_t k;
+
+  while (i < n) {
+    while ((i < n) && isspace ((unsigned char) src[i]))
+      i++;
+    /* Copy the word to where its filtered version goes, then filter it there. */
+    b = len + (len > 0);
+    k = 0;
+    for (; (i < n) && !isspace ((unsigned char) src[i]); i++)
+      if (!isunicode ((unsigned char) src[i]))
+        dst[b + k++] = src[i];
+    if (k == 0)
+      continue;
+    k = filterword (dst + b, dst + b, k);
+    if (k > 0) {
+      if (len > 0)
+        dst[len] = ' ';
+      len = b + k;
+    }
+  }
+  if (len > 0)
+    dst[len++] = '\n';
+  return len;
+}
+
 char *
 filter (char *restrict src)
 {
@@ -97,7 +143,7 @@ filter (char *restrict src)
   size_t n;
 
   while (word = strtok_r (inp, " ", &inp), word) {
-    n = filterword (out, word);
+    n = filterword (out, word, strlen (word));
     if (n > 0) {
       out += n;
       if (*inp)
@@ -0,0 +1,10 @@
+#ifndef TECTOR_FILTER_H
+#define TECTOR_FILTER_H
+
+#include <stdlib.h>
+
+size_t filterword (char *dst, const char *src, size_t n);
+size_t filterline (char *dst, const char *src, size_t n);
+char *filter (char *s);
+
+#endif
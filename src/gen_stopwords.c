@@ -0,0 +1,74 @@
+/**
+ * Generates the perfect hash set of the built-in stopwords. Reads one word
+ * per line from the file passed as argument and writes C code to stdout.
+ */
+#include "config.h"
+#include "phash.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int
+main (int argc, char **argv)
+{
+  struct phash p;
+  char **words = NULL;
+  char line[256];
+  size_t len = 0;
+  size_t cap = 0;
+  size_t i;
+  FILE *f;
+
+  if (argc != 2) {
+    fprintf (stderr, "usage: %s STOPWORDS\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  f = fopen (argv[1], "r");
+  if (f == NULL) {
+    perror (argv[1]);
+    return EXIT_FAILURE;
+  }
+  while (fgets (line, sizeof (line), f)) {
+    line[strcspn (line, "\r\n")] = '\0';
+    if (line[0] == '\0')
+      continue;
+    if (len == cap) {
+      cap = reqcap (len + 1, cap, 256);
+      words = mem_realloc (words, cap, sizeof (char *));
+      if (words == NULL)
+        return EXIT_FAILURE;
+    }
+    words[len] = strdup (line);
+    if (words[len++] == NULL)
+      return EXIT_FAILURE;
+  }
+  fclose (f);
+
+  if (phash_build (&p, (const char *const *) words, len) != 0) {
+    fprintf (stderr, "failed to build perfect hash\n");
+    return EXIT_FAILURE;
+  }
+  printf ("/* Generated from %s, do not edit. */\n\n", argv[1]);
+  printf ("static const uint32_t builtin_seeds[%u] = {\n", p.buckets);
+  for (i = 0; i < p.buckets; i++)
+    printf ("  %u,\n", p.seeds[i]);
+  printf ("};\n\n");
+  printf ("static const char *const builtin_keys[%u] = {\n", p.slots);
+  for (i = 0; i < p.slots; i++)
+    if (p.keys[i])
+      printf ("  [%zu] = \"%s\",\n", i, p.keys[i]);
+  printf ("};\n\n");
+  printf ("static const struct phash builtin = {\n");
+  printf ("  .buckets = %u,\n", p.buckets);
+  printf ("  .slots = %u,\n", p.slots);
+  printf ("  .seeds = builtin_seeds,\n");
+  printf ("  .keys = builtin_keys,\n");
+  printf ("};\n");
+
+  phash_free (&p);
+  for (i = 0; i < len; i++)
+    free (words[i]);
+  mem_free (words);
+  return EXIT_SUCCESS;
+}
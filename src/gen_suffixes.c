@@ -0,0 +1,142 @@
+/**
+ * Generates the suffix automaton of steps 2 to 4 of the Porter stemmer and
+ * writes it as C code to stdout. The suffixes of every step are inserted in
+ * reverse into a trie, so a stemmer finds the longest matching suffix in one
+ * walk from the end of a word towards its start.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * State 0 is the dead state, the tables use bytes for states and rules.
+ */
+#define MAX_STATES 256
+
+struct rule {
+  int step;
+  const char *suffix;
+  const char *to;
+  int cond;
+};
+
+/**
+ * Cond marks suffixes that only match after an 's' or 't'. Step 4 removes
+ * suffixes, it has no replacements.
+ */
+static const struct rule rules[] = {
+  { 2, "ational", "ate", 0 },
+  { 2, "tional", "tion", 0 },
+  { 2, "enci", "ence", 0 },
+  { 2, "anci", "ance", 0 },
+  { 2, "izer", "ize", 0 },
+  { 2, "bli", "ble", 0 },
+  { 2, "alli", "al", 0 },
+  { 2, "entli", "ent", 0 },
+  { 2, "eli", "e", 0 },
+  { 2, "ousli", "ous", 0 },
+  { 2, "ization", "ize", 0 },
+  { 2, "ation", "ate", 0 },
+  { 2, "ator", "ate", 0 },
+  { 2, "alism", "al", 0 },
+  { 2, "iveness", "ive", 0 },
+  { 2, "fulness", "ful", 0 },
+  { 2, "ousness", "ous", 0 },
+  { 2, "aliti", "al", 0 },
+  { 2, "iviti", "ive", 0 },
+  { 2, "biliti", "ble", 0 },
+  { 2, "logi", "log", 0 },
+  { 3, "icate", "ic", 0 },
+  { 3, "ative", "", 0 },
+  { 3, "alize", "al", 0 },
+  { 3, "iciti", "ic", 0 },
+  { 3, "ical", "ic", 0 },
+  { 3, "ful", "", 0 },
+  { 3, "ness", "", 0 },
+  { 4, "al", "", 0 },
+  { 4, "ance", "", 0 },
+  { 4, "ence", "", 0 },
+  { 4, "er", "", 0 },
+  { 4, "ic", "", 0 },
+  { 4, "able", "", 0 },
+  { 4, "ible", "", 0 },
+  { 4, "ant", "", 0 },
+  { 4, "ement", "", 0 },
+  { 4, "ment", "", 0 },
+  { 4, "ent", "", 0 },
+  { 4, "ion", "", 1 },
+  { 4, "ou", "", 0 },
+  { 4, "ism", "", 0 },
+  { 4, "ate", "", 0 },
+  { 4, "iti", "", 0 },
+  { 4, "ous", "", 0 },
+  { 4, "ive", "", 0 },
+  { 4, "ize", "", 0 },
+};
+
+static uint8_t next[MAX_STATES][26];
+static uint8_t accept[MAX_STATES];
+static size_t states = 1;
+
+static size_t
+newstate (void)
+{
+  if (states == MAX_STATES) {
+    fprintf (stderr, "too many states\n");
+    exit (EXIT_FAILURE);
+  }
+  return states++;
+}
+
+int
+main (void)
+{
+  const size_t n = sizeof (rules) / sizeof (rules[0]);
+  size_t start[5] = { 0 };
+  size_t s;
+  size_t i;
+  size_t j;
+  size_t k;
+  int c;
+
+  for (i = 0; i < n; i++) {
+    if (start[rules[i].step] == 0)
+      start[rules[i].step] = newstate ();
+    s = start[rules[i].step];
+    for (j = strlen (rules[i].suffix); j-- > 0;) {
+      c = rules[i].suffix[j] - 'a';
+      if (next[s][c] == 0)
+        next[s][c] = (uint8_t) newstate ();
+      s = next[s][c];
+    }
+    if (accept[s]) {
+      fprintf (stderr, "duplicate suffix %s\n", rules[i].suffix);
+      return EXIT_FAILURE;
+    }
+    accept[s] = (uint8_t) (i + 1);
+  }
+
+  printf ("/* Generated by gen_suffixes, do not edit. */\n\n");
+  for (k = 2; k <= 4; k++)
+    printf ("#define SUFFIX_STEP%zu %zu\n", k, start[k]);
+  printf ("\nstatic const uint8_t suffix_next[%zu][26] = {\n", states);
+  for (s = 0; s < states; s++) {
+    printf ("  {");
+    for (c = 0; c < 26; c++)
+      printf ("%s%u", c ? "," : "", next[s][c]);
+    printf ("},\n");
+  }
+  printf ("};\n\n");
+  printf ("static const uint8_t suffix_accept[%zu] = {\n", states);
+  for (s = 0; s < states; s++)
+    printf ("  %u,\n", accept[s]);
+  printf ("};\n\n");
+  printf ("static const struct suffix suffix_rules[%zu] = {\n", n + 1);
+  printf ("  { 0, 0, \"\" },\n");
+  for (i = 0; i < n; i++)
+    printf ("  { %zu, %d, \"\\%03zo%s\" }, /* %s */\n", strlen (rules[i].suffix),
+        rules[i].cond, strlen (rules[i].to), rules[i].to, rules[i].suffix);
+  printf ("};\n");
+  return EXIT_SUCCESS;
+}
@@ -1,50 +1,381 @@
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
-#include <unistd.h>
+#include <string.h>
 
+#include "adapter.h"
+#include "bundle.h"
+#include "dedup.h"
+#include "filter.h"
 #include "log.h"
+#include "macros.h"
+#include "mem.h"
 #include "program.h"
 #include "scanner.h"
-#include "string.h"
+#include "shard.h"
+#include "stemcache.h"
+#include "stopwords.h"
 
 struct program program = {
   .name = "filter",
   .info = "cleans text, peforms stemming and stopword removal",
   .commands = {
-    { .args = "TEXTFILE..." },
+    { .args = "TEXTFILE...", .opts = "bdfjs" },
     {},
   },
 };
 
+/**
+ * Size of the batches of lines handed to the workers.
+ */
+#define BATCH_SIZE (1 << 20)
+
+enum {
+  FREE,
+  FILLED,
+  DONE,
+};
+
+struct buffer {
+  char *ptr;
+  size_t len;
+  size_t cap;
+};
+
+struct batch {
+  int state;
+  struct buffer in;
+  struct buffer out;
+};
+
+/**
+ * The reader fills the batches of the ring in order, the workers filter
+ * them in any order, and the writer writes them in order again. The counters
+ * only grow, the batch of counter i is batches[i % len].
+ */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct batch *batches;
+  size_t len;
+  size_t head;
+  size_t next;
+  size_t tail;
+  bool eof;
+} ring = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned int jobs = 1;
+
+/**
+ * The format and dedup table of the input files.
+ */
+static struct scanner_options options;
+
+/**
+ * The vocab of the bundle passed with -b, lines get written as shard
+ * records of its ids instead of text.
+ */
+static struct vocab *vocab = NULL;
+
+static int
+reserve (struct buffer *b, size_t n)
+{
+  if (b->len + n <= b->cap)
+    return 0;
+  b->cap = reqcap (b->len + n, b->cap, BATCH_SIZE);
+  b->ptr = mem_realloc (b->ptr, b->cap, 1);
+  return -(b->ptr == NULL);
+}
+
+/**
+ * Filters the line p of length n and appends it to b. Shard records get
+ * encoded from the filtered text, which goes behind the room of the record.
+ */
+static void
+convert (struct buffer *b, const char *p, size_t n)
+{
+  char *t;
+
+  if (vocab == NULL) {
+    if (reserve (b, n + 2) != 0)
+      fatal ("mem_realloc");
+    b->len += filterline (b->ptr + b->len, p, n);
+    return;
+  }
+  if (reserve (b, SHARD_MAX (n) + n + 2) != 0)
+    fatal ("mem_realloc");
+  t = b->ptr + b->len + SHARD_MAX (n);
+  b->len += shard_encode (b->ptr + b->len, vocab, t, filterline (t, p, n));
+}
+
+/**
+ * Filters every line of s and writes it to stdout. Fails if s can't be read
+ * to its end.
+ */
 static int
 filter_lines (struct scanner *s)
 {
-  char b[8192] = { 0 };
+  struct buffer b = { NULL, 0, 0 };
+  const char *p;
+  size_t n;
+  int r;
 
   if (s == NULL)
     return -1;
-  while (scanner_readline (s, b, sizeof (b)) >= 0) {
-    filter (b);
-    if (*b)
-      puts (b);
+  while (r = scanner_readtext (s, &p, &n), r == 0) {
+    b.len = 0;
+    convert (&b, p, n);
+    fwrite (b.ptr, 1, b.len, stdout);
   }
+  if (b.ptr)
+    mem_free (b.ptr);
   scanner_free (s);
-  return 0;
+  return -(r != -1);
 }
 
-int
-main (int argc, char **argv)
+static struct batch *
+acquire (void)
+{
+  struct batch *b;
+
+  pthread_mutex_lock (&ring.lock);
+  b = &ring.batches[ring.head % ring.len];
+  while (b->state != FREE)
+    pthread_cond_wait (&ring.cond, &ring.lock);
+  pthread_mutex_unlock (&ring.lock);
+  b->in.len = 0;
+  return b;
+}
+
+static void
+submit (struct batch *b)
+{
+  pthread_mutex_lock (&ring.lock);
+  b->state = FILLED;
+  ring.head++;
+  pthread_cond_broadcast (&ring.cond);
+  pthread_mutex_unlock (&ring.lock);
+}
+
+/**
+ * Copies the lines of s into batches. A batch only gets submitted once the
+ * next line doesn't fit, so batches are shared by consecutive files.
+ */
+static int
+read_lines (struct scanner *s, struct batch **b)
+{
+  const char *p;
+  size_t n;
+  int r;
+
+  if (s == NULL)
+    return -1;
+  while (r = scanner_readtext (s, &p, &n), r == 0) {
+    if ((*b)->in.len + n + 1 > BATCH_SIZE) {
+      if ((*b)->in.len > 0) {
+        submit (*b);
+        *b = acquire ();
+      }
+    }
+    if (reserve (&(*b)->in, n + 1) != 0)
+      fatal ("mem_realloc");
+    memcpy ((*b)->in.ptr + (*b)->in.len, p, n);
+    (*b)->in.len += n;
+    (*b)->in.ptr[(*b)->in.len++] = '\n';
+  }
+  scanner_free (s);
+  return -(r != -1);
+}
+
+static void *
+work (void *arg)
+{
+  struct batch *b;
+  const char *p;
+  const char *e;
+  const char *nl;
+
+  (void) arg;
+  pthread_mutex_lock (&ring.lock);
+  for (;;) {
+    while ((ring.next == ring.head) && (!ring.eof))
+      pthread_cond_wait (&ring.cond, &ring.lock);
+    if (ring.next == ring.head)
+      break;
+    b = &ring.batches[ring.next++ % ring.len];
+    pthread_mutex_unlock (&ring.lock);
+
+    b->out.len = 0;
+    for (p = b->in.ptr, e = p + b->in.len; p < e; p = nl + 1) {
+      nl = memchr (p, '\n', (size_t) (e - p));
+      convert (&b->out, p, (size_t) (nl - p));
+    }
+
+    pthread_mutex_lock (&ring.lock);
+    b->state = DONE;
+    pthread_cond_broadcast (&ring.cond);
+  }
+  pthread_mutex_unlock (&ring.lock);
+  stemcache_flush ();
+  return NULL;
+}
+
+static void *
+write_lines (void *arg)
 {
+  struct batch *b;
+
+  (void) arg;
+  pthread_mutex_lock (&ring.lock);
+  for (;;) {
+    b = &ring.batches[ring.tail % ring.len];
+    while ((ring.tail < ring.head) ? (b->state != DONE) : (!ring.eof))
+      pthread_cond_wait (&ring.cond, &ring.lock);
+    if (ring.tail == ring.head)
+      break;
+    pthread_mutex_unlock (&ring.lock);
+
+    fwrite (b->out.ptr, 1, b->out.len, stdout);
+
+    pthread_mutex_lock (&ring.lock);
+    b->state = FREE;
+    ring.tail++;
+    pthread_cond_broadcast (&ring.cond);
+  }
+  pthread_mutex_unlock (&ring.lock);
+  return NULL;
+}
+
+/**
+ * Filters the arguments with jobs worker threads, while the calling thread
+ * reads the input and another thread writes the output in input order.
+ */
+static void
+run (void)
+{
+  pthread_t *threads;
+  pthread_t writer;
+  struct batch *b;
   char *arg;
+  size_t i;
 
-  program_init (argc, argv);
+  ring.len = 2 * (size_t) jobs + 2;
+  ring.batches = mem_alloc (ring.len, sizeof (struct batch));
+  threads = mem_alloc (jobs, sizeof (pthread_t));
+  if ((ring.batches == NULL) || (threads == NULL))
+    fatal ("mem_alloc");
+  for (i = 0; i < jobs; i++)
+    if (pthread_create (&threads[i], NULL, work, NULL) != 0)
+      fatal ("pthread_create");
+  if (pthread_create (&writer, NULL, write_lines, NULL) != 0)
+    fatal ("pthread_create");
 
+  b = acquire ();
   arg = program_poparg ();
   if (arg == NULL)
-    filter_lines (scanner_new (STDIN_FILENO));
+    read_lines (scanner_open ("-", &options), &b);
   while (arg) {
-    if (filter_lines (scanner_open (arg)) != 0)
-      error ("failed to open '%s'", arg);
+    if (read_lines (scanner_open (arg, &options), &b) != 0)
+      error ("failed to read '%s'", arg);
     arg = program_poparg ();
   }
+  if (b->in.len > 0)
+    submit (b);
+
+  pthread_mutex_lock (&ring.lock);
+  ring.eof = true;
+  pthread_cond_broadcast (&ring.cond);
+  pthread_mutex_unlock (&ring.lock);
+  for (i = 0; i < jobs; i++)
+    pthread_join (threads[i], NULL);
+  pthread_join (writer, NULL);
+
+  for (i = 0; i < ring.len; i++) {
+    if (ring.batches[i].in.ptr)
+      mem_free (ring.batches[i].in.ptr);
+    if (ring.batches[i].out.ptr)
+      mem_free (ring.batches[i].out.ptr);
+  }
+  mem_free (ring.batches);
+  mem_free (threads);
+}
+
+int
+main (int argc, char **argv)
+{
+  char header[sizeof (struct shard_header)];
+  const char *format = NULL;
+  struct adapter adapter;
+  const char *stopwords = NULL;
+  const char *path = NULL;
+  struct bundle *b = NULL;
+  struct dedup *d = NULL;
+  unsigned int size = 0;
+  size_t lookups;
+  size_t hits;
+  char *arg;
+
+  program_init (argc, argv);
+  program_getoptuint ('j', &jobs);
+  jobs = max (jobs, 1);
+  program_getoptstr ('f', &format);
+  if (format) {
+    if (adapter_parse (&adapter, format) != 0)
+      fatal ("unknown format %s", format);
+    options.format = &adapter;
+  }
+  program_getoptstr ('s', &stopwords);
+  if ((stopwords) && (stopwords_load (stopwords) != 0))
+    fatal ("failed to load stopwords from '%s'", stopwords);
+  program_getoptuint ('d', &size);
+  if (size) {
+    d = dedup_new ((size_t) size << 20);
+    if (d == NULL)
+      fatal ("dedup_new");
+    options.dedup = d;
+  }
+  program_getoptstr ('b', &path);
+  if (path) {
+    b = bundle_open (path);
+    if (b == NULL)
+      fatal ("bundle_open");
+    if (b->vocab == NULL)
+      fatal ("vocab missing");
+    vocab = b->vocab;
+  }
+
+  /* Output gets written in large chunks either way. */
+  setvbuf (stdout, NULL, _IOFBF, BATCH_SIZE);
+  if (vocab)
+    fwrite (header, 1, shard_header (header, vocab), stdout);
+  if (jobs > 1) {
+    run ();
+  }
+  else {
+    arg = program_poparg ();
+    if (arg == NULL)
+      filter_lines (scanner_open ("-", &options));
+    while (arg) {
+      if (filter_lines (scanner_open (arg, &options)) != 0)
+        error ("failed to read '%s'", arg);
+      arg = program_poparg ();
+    }
+  }
+  fflush (stdout);
+  if (d) {
+    dedup_report (d);
+    dedup_free (d);
+  }
+  if (b)
+    bundle_free (b);
+  if (stopwords)
+    stopwords_reset ();
+  stemcache_flush ();
+  stemcache_stats (&hits, &lookups);
+  if (lookups > 0)
+    info ("stem cache hit rate %.2f %% (%zu of %zu)", (double) hits / (double) lookups * 100.0, hits, lookups);
   return 0;
 }
@@ -1,11 +1,21 @@
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "program.h"
+#include "adapter.h"
 #include "bundle.h"
+#include "dedup.h"
 #include "log.h"
+#include "macros.h"
+#include "mem.h"
 #include "model.h"
+#include "queue.h"
+#include "scanner.h"
+#include "shard.h"
+#include "stopwords.h"
 
 static void create (void);
 static void train (void);
@@ -16,7 +26,7 @@ struct program program = {
   .info = "manage language models",
   .commands = {
     { .name = "create", .args = "DIR", .opts = "iltvw", .main = create },
-    { .name = "train", .args = "DIR TEXTFILE...", .main = train },
+    { .name = "train", .args = "DIR TEXTFILE...", .opts = "dfjrs", .main = train },
     { .name = "generate", .args = "DIR", .main = generate },
     {},
   },
@@ -28,6 +38,20 @@ static unsigned int layer;
 static unsigned int vector;
 static unsigned int window;
 static unsigned int type = MODEL_NN;
+/**
+ * Number of parser threads, one by default. Waiting threads hold the corpus
+ * of a whole file, so memory grows with every thread.
+ */
+static unsigned int jobs = 1;
+
+/**
+ * The format, dedup table and filter setting of the input files.
+ */
+static struct scanner_options options;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turned = PTHREAD_COND_INITIALIZER;
+static struct queue *queue;
+static size_t turn;
 
 #define entry(x) [MODEL_ ## x] = #x
 static const char *model_name[] = {
@@ -56,26 +80,111 @@ create (void)
   model_verify (b->model);
 }
 
+/**
+ * Number of sentences stdin gets trained in. Files are trained as a whole.
+ */
+#define BLOCK_SIZE 262144
+
+/**
+ * Waits until it is the turn of the queue entry i and returns with the lock
+ * held.
+ */
+static void
+wait_turn (size_t i)
+{
+  pthread_mutex_lock (&lock);
+  while (turn != i)
+    pthread_cond_wait (&turned, &lock);
+}
+
+/**
+ * Threads parse their files in parallel, but the model gets trained on one
+ * corpus at a time, in the order of the queue. That way, the model comes out
+ * the same no matter how many threads there are. Streams are trained block
+ * by block, so that memory doesn't grow with the length of the stream.
+ * Shards written by filter -b get read without looking up their words.
+ */
+static void
+parse (void *arg, const struct queue_entry *e)
+{
+  const char *path = e->path;
+  struct corpus *c = arg;
+  struct scanner *s = NULL;
+  struct shard *h = NULL;
+  size_t i = (size_t) (e - queue->entries);
+  size_t n = SIZE_MAX;
+  int r;
+
+  if (strcmp (path, "-") == 0)
+    n = BLOCK_SIZE;
+  else if (shard_probe (path)) {
+    h = shard_open (path, b->vocab);
+    if (h == NULL)
+      fatal ("failed to open '%s'", path);
+  }
+  if (h == NULL) {
+    s = queue_open (e, &options);
+    if (s == NULL)
+      fatal ("failed to open '%s'", path);
+  }
+  do {
+    r = (h) ? corpus_readshard (c, h, n) : corpus_read (c, s, n);
+    if (r < 0)
+      fatal ("corpus_read '%s'", path);
+    if (c->sentences.len > 0) {
+      wait_turn (i);
+      if (model_train (b->model, c) != 0)
+        fatal ("model_train");
+      pthread_mutex_unlock (&lock);
+    }
+    corpus_clear (c);
+  } while (r == 0);
+  wait_turn (i);
+  turn++;
+  pthread_cond_broadcast (&turned);
+  pthread_mutex_unlock (&lock);
+  if (h)
+    shard_free (h);
+  else
+    scanner_free (s);
+}
+
 static void
 train (void)
 {
-  struct corpus *c;
+  struct corpus **c;
+  struct queue *q;
   char *arg;
+  size_t n;
+  size_t i;
 
   if (b->model == NULL)
     fatal ("model missing");
-  c = corpus_new (b->vocab);
-  if (c == NULL)
-    fatal ("corpus_new");
-
+  q = queue_new ();
+  if (q == NULL)
+    fatal ("queue_new");
   while (arg = program_poparg (), arg != NULL) {
-    if (corpus_parse (c, arg) != 0)
-      fatal ("corpus_parse");
-    if (model_train (b->model, c) != 0)
-      fatal ("model_train");
-    corpus_clear (c);
+    if (queue_add (q, arg) != 0)
+      error ("failed to add '%s'", arg);
   }
-  corpus_free (c);
+
+  n = max (min (jobs, q->len), 1);
+  c = mem_alloc (n, sizeof (struct corpus *));
+  if (c == NULL)
+    fatal ("mem_alloc");
+  for (i = 0; i < n; i++) {
+    c[i] = corpus_new (b->vocab);
+    if (c[i] == NULL)
+      fatal ("corpus_new");
+  }
+  queue = q;
+  turn = q->pos;
+  if (queue_run (q, n, parse, (void **) c) != 0)
+    fatal ("queue_run");
+  for (i = 0; i < n; i++)
+    corpus_free (c[i]);
+  mem_free (c);
+  queue_free (q);
 }
 
 static void
@@ -93,7 +202,7 @@ generate (void)
 
   n = b->model->size.vector;
   for (i = 0; i < b->vocab->len; i++) {
-    printf ("%s ", b->vocab->entries[i].word);
+    printf ("%s ", vocab_word (b->vocab, i));
     for (j = 0; j < n; j++)
       printf ("%f%c", b->model->embeddings[i * n + j], "\n "[j < (n - 1)]);
   }
@@ -102,6 +211,12 @@ generate (void)
 int
 main (int argc, char **argv)
 {
+  const char *format = NULL;
+  const char *stopwords = NULL;
+  struct adapter adapter;
+  struct dedup *d = NULL;
+  unsigned int size = 0;
+  int raw = 0;
   const char *typestr = NULL;
 
   program_init (argc, argv);
@@ -109,7 +224,26 @@ main (int argc, char **argv)
   program_getoptuint ('l', &layer);
   program_getoptuint ('v', &vector);
   program_getoptuint ('w', &window);
+  program_getoptuint ('j', &jobs);
   program_getoptstr ('t', &typestr);
+  program_getoptstr ('f', &format);
+  if (format) {
+    if (adapter_parse (&adapter, format) != 0)
+      fatal ("unknown format %s", format);
+    options.format = &adapter;
+  }
+  program_getoptbool ('r', &raw);
+  options.filter = raw;
+  program_getoptstr ('s', &stopwords);
+  if ((stopwords) && (stopwords_load (stopwords) != 0))
+    fatal ("failed to load stopwords from '%s'", stopwords);
+  program_getoptuint ('d', &size);
+  if (size) {
+    d = dedup_new ((size_t) size << 20);
+    if (d == NULL)
+      fatal ("dedup_new");
+    options.dedup = d;
+  }
 
   if (typestr) {
     for (type = 0; type < NUM_MODELS; type++) {
@@ -124,6 +258,10 @@ main (int argc, char **argv)
   if (b == NULL)
     fatal ("bundle_open");
   program_run ();
+  if (d) {
+    dedup_report (d);
+    dedup_free (d);
+  }
   bundle_save (b);
   bundle_free (b);
   return 0;
@@ -1,8 +1,16 @@
 #include <string.h>
+#include <unistd.h>
 
 #include "program.h"
+#include "adapter.h"
 #include "bundle.h"
+#include "dedup.h"
 #include "log.h"
+#include "macros.h"
+#include "mem.h"
+#include "queue.h"
+#include "scanner.h"
+#include "stopwords.h"
 #include "vocab.h"
 
 static void create (void);
@@ -13,8 +21,8 @@ struct program program = {
   .name = "vocab",
   .info = "manage vocabularies",
   .commands = {
-    { .name = "create", .args = "DIR", .opts = "m", .main = create },
-    { .name = "train", .args = "DIR TEXTFILE...", .main = train },
+    { .name = "create", .args = "DIR", .opts = "cmn", .main = create },
+    { .name = "train", .args = "DIR TEXTFILE...", .opts = "cdfjnrs", .main = train },
     { .name = "print", .args = "DIR", .main = print },
     {},
   },
@@ -22,6 +30,14 @@ struct program program = {
 
 static struct bundle *b;
 static unsigned int min = 10;
+static unsigned int limit = 0;
+static unsigned int keep = 0;
+static unsigned int jobs;
+
+/**
+ * The format, dedup table and filter setting of the input files.
+ */
+static struct scanner_options options;
 
 static void
 create (void)
@@ -32,19 +48,76 @@ create (void)
   if (b->vocab == NULL)
     fatal ("vocab_new");
   b->vocab->min = min;
+  b->vocab->limit = limit;
+  b->vocab->keep = keep;
 }
 
+static void
+parse (void *arg, const struct queue_entry *e)
+{
+  struct scanner *s;
+
+  s = queue_open (e, &options);
+  if ((s == NULL) || (vocab_scan (arg, s) != 0))
+    error ("vocab_scan '%s' failed", e->path);
+  if (s)
+    scanner_free (s);
+}
+
+/**
+ * Every thread counts its files, or ranges of large files, in a vocab of its
+ * own. The first thread uses the bundle's vocab, the others get merged into
+ * it afterwards, by all threads at once. A limit applies to every thread's
+ * vocab. The rows of an existing model move to the new word ids.
+ */
 static void
 train (void)
 {
+  struct vocab **v;
+  struct queue *q;
   char *arg;
+  size_t n;
+  size_t i;
 
   if (b->vocab == NULL)
     fatal ("vocab missing");
+  if (limit)
+    b->vocab->limit = limit;
+  if (keep)
+    b->vocab->keep = keep;
+  q = queue_new ();
+  if (q == NULL)
+    fatal ("queue_new");
   while (arg = program_poparg (), arg != NULL) {
-    if (vocab_parse (b->vocab, arg) != 0)
-      error ("vocab_parse '%s' failed", arg);
+    if (queue_add (q, arg) != 0)
+      error ("failed to add '%s'", arg);
   }
+  if ((jobs > 1) && (queue_split (q, jobs, &options) != 0))
+    fatal ("queue_split");
+
+  n = max (min (jobs, q->len), 1);
+  v = mem_alloc (n, sizeof (struct vocab *));
+  if (v == NULL)
+    fatal ("mem_alloc");
+  v[0] = b->vocab;
+  for (i = 1; i < n; i++) {
+    v[i] = vocab_new ();
+    if (v[i] == NULL)
+      fatal ("vocab_new");
+    v[i]->limit = b->vocab->limit;
+  }
+  if (queue_run (q, n, parse, (void **) v) != 0)
+    fatal ("queue_run");
+  if (vocab_mergeall (b->vocab, v + 1, n - 1, n) != 0)
+    fatal ("vocab_mergeall");
+  for (i = 1; i < n; i++)
+    vocab_free (v[i]);
+  mem_free (v);
+  queue_free (q);
+  if (b->vocab->error)
+    info ("vocab is capped, counts may be up to %zu too low", b->vocab->error);
+  if ((b->model) && (bundle_remap (b) != 0))
+    fatal ("bundle_remap");
 }
 
 static void
@@ -55,19 +128,52 @@ print (void)
   if (b->vocab == NULL)
     fatal ("vocab missing");
   for (i = 0; i < b->vocab->len; i++)
-    printf ("%8u %s\n", b->vocab->entries[i].count, b->vocab->entries[i].word);
+    printf ("%8u %s\n", b->vocab->count[i], vocab_word (b->vocab, i));
 }
 
 int
 main (int argc, char **argv)
 {
+  const char *format = NULL;
+  const char *stopwords = NULL;
+  struct adapter adapter;
+  struct dedup *d = NULL;
+  unsigned int size = 0;
+  int raw = 0;
+
   program_init (argc, argv);
   program_getoptuint ('m', &min);
+  program_getoptuint ('c', &limit);
+  program_getoptuint ('n', &keep);
+  jobs = (unsigned int) max (sysconf (_SC_NPROCESSORS_ONLN), 1);
+  program_getoptuint ('j', &jobs);
+  program_getoptstr ('f', &format);
+  if (format) {
+    if (adapter_parse (&adapter, format) != 0)
+      fatal ("unknown format %s", format);
+    options.format = &adapter;
+  }
+  program_getoptbool ('r', &raw);
+  options.filter = raw;
+  program_getoptstr ('s', &stopwords);
+  if ((stopwords) && (stopwords_load (stopwords) != 0))
+    fatal ("failed to load stopwords from '%s'", stopwords);
+  program_getoptuint ('d', &size);
+  if (size) {
+    d = dedup_new ((size_t) size << 20);
+    if (d == NULL)
+      fatal ("dedup_new");
+    options.dedup = d;
+  }
 
   b = bundle_open (program_poparg ());
   if (b == NULL)
     fatal ("bundle_open");
   program_run ();
+  if (d) {
+    dedup_report (d);
+    dedup_free (d);
+  }
   bundle_save (b);
   bundle_free (b);
   return 0;
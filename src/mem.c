@@ -56,14 +56,15 @@ bookkeep (int mode, void *ptr)
 {
   const size_t size = malloc_usable_size (ptr);
 
+  /* Worker threads allocate too. */
   switch (mode) {
     case ADD:
-      used += size;
-      objects += !!size;
+      __atomic_add_fetch (&used, size, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&objects, !!size, __ATOMIC_RELAXED);
       break;
     case SUB:
-      used -= size;
-      objects -= !!size;
+      __atomic_sub_fetch (&used, size, __ATOMIC_RELAXED);
+      __atomic_sub_fetch (&objects, !!size, __ATOMIC_RELAXED);
       break;
   }
   logusage ();
@@ -106,6 +107,8 @@ mem_align (size_t nmemb, size_t size, size_t alignment)
 void *
 mem_realloc (void *ptr, size_t nmemb, size_t size)
 {
+  void *r;
+
   /**
    * Passing NULL to realloc would work as well but doesn't initialize memory
    * so we just use calloc-based mem_alloc function instead.
@@ -115,9 +118,10 @@ mem_realloc (void *ptr, size_t nmemb, size_t size)
 
   if (valid (nmemb, size)) {
     bookkeep (SUB, ptr);
-    if (ptr = realloc (ptr, nmemb * size), ptr != NULL)
-      bookkeep (ADD, ptr);
-    return ptr;
+    r = realloc (ptr, nmemb * size);
+    /* The old block stays allocated if realloc fails. */
+    bookkeep (ADD, r ? r : ptr);
+    return r;
   }
   return NULL;
 }
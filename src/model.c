@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
@@ -50,6 +51,8 @@ model_new (struct vocab *v, unsigned int type)
   m->v = v;
   m->type = type;
   m->size.vocab = v->len;
+  if ((v->code == NULL) && (vocab_encode (v) != 0))
+    goto error;
   if (m->i->init (m) != 0)
     goto error;
   m->state.changed = 1;
@@ -153,3 +156,39 @@ model_verify (struct model *m)
 {
   return m->i->verify (m);
 }
+
+/**
+ * Moves the rows of the model to the word ids of a changed vocab of len
+ * words. The word with the new id i had the id map[i], or is new if map[i] is
+ * SIZE_MAX.
+ */
+int
+model_remap (struct model *m, const size_t *map, size_t len)
+{
+  if (model_alloc (m) != 0)
+    return -1;
+  if (m->i->remap (m, map, len) != 0)
+    return -1;
+  m->size.vocab = len;
+  m->state.changed = 1;
+  return 0;
+}
+
+/**
+ * Returns the rows of width floats at src rearranged by map, see model_remap.
+ * The rows of new words are zero.
+ */
+float *
+model_remaprows (const float *src, const size_t *map, size_t len, size_t width)
+{
+  float *dst;
+  size_t i;
+
+  dst = mem_alloc (len * width + 1, sizeof (float));
+  if (dst == NULL)
+    return NULL;
+  for (i = 0; i < len; i++)
+    if (map[i] != SIZE_MAX)
+      memcpy (dst + i * width, src + map[i] * width, width * sizeof (float));
+  return dst;
+}
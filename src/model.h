@@ -42,6 +42,7 @@ struct model_interface {
   int (*save) (struct model *, struct file *);
   int (*generate) (struct model *);
   int (*verify) (struct model *);
+  int (*remap) (struct model *, const size_t *, size_t);
 };
 
 struct model *model_new (struct vocab *, unsigned int);
@@ -52,5 +53,7 @@ int model_save (struct model *, const char *);
 int model_train (struct model *, struct corpus *);
 int model_generate (struct model *);
 int model_verify (struct model *);
+int model_remap (struct model *, const size_t *, size_t);
+float *model_remaprows (const float *, const size_t *, size_t, size_t);
 
 #endif
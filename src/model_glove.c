@@ -30,6 +30,7 @@ int glove_alloc (struct model *);
 int glove_train (struct model *, struct corpus *);
 int glove_generate (struct model *);
 int glove_verify (struct model *);
+int glove_remap (struct model *, const size_t *, size_t);
 
 const struct model_interface interface_glove = {
   .size = sizeof (struct glove),
@@ -41,6 +42,7 @@ const struct model_interface interface_glove = {
   .train = glove_train,
   .generate = glove_generate,
   .verify = glove_verify,
+  .remap = glove_remap,
 };
 
 int
@@ -111,7 +113,7 @@ train (struct glove *restrict m, struct sentence *restrict s)
         continue;
       k = i + j - sw;
       if (inrange (k, 0, (long long) s->len))
-        m->cnt[x + (m->base.v->entries[s->words[k]].hash % sl)] += 1.0 / fabs ((float) (k - i));
+        m->cnt[x + (m->base.v->hash[s->words[k]] % sl)] += 1.0 / fabs ((float) (k - i));
     }
   }
 }
@@ -242,3 +244,21 @@ glove_verify (struct model *base)
     warning ("consider using >= 10 iterations");
   return 0;
 }
+
+/**
+ * The rows of the counts belong to words and move with them, new words start
+ * without counts. The columns are buckets of word hashes, which don't change.
+ */
+int
+glove_remap (struct model *base, const size_t *map, size_t len)
+{
+  struct glove *m = (struct glove *) base;
+  float *cnt;
+
+  cnt = model_remaprows (m->cnt, map, len, base->size.layer);
+  if (cnt == NULL)
+    return -1;
+  mem_free (m->cnt);
+  m->cnt = cnt;
+  return 0;
+}
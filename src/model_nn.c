@@ -33,6 +33,7 @@ int nn_alloc (struct model *);
 int nn_train (struct model *, struct corpus *);
 int nn_generate (struct model *);
 int nn_verify (struct model *);
+int nn_remap (struct model *, const size_t *, size_t);
 
 const struct model_interface interface_nn = {
   .size = sizeof (struct nn),
@@ -44,6 +45,7 @@ const struct model_interface interface_nn = {
   .train = nn_train,
   .generate = nn_generate,
   .verify = nn_verify,
+  .remap = nn_remap,
 };
 
 const float alpha = 0.05;
@@ -161,15 +163,15 @@ subsample (struct sentence *dst, const struct sentence *src, size_t n)
 }
 
 static inline void
-hierarchical_softmax (struct nn *restrict m, struct vocab_entry *restrict e)
+hierarchical_softmax (struct nn *restrict m, size_t w)
 {
   const long long sl = (long long) m->base.size.layer;
 
   long long i, j;
   float f, g;
 
-  uint64_t code = e->code;
-  int32_t *point = e->point;
+  uint64_t code = m->base.v->code[w];
+  const int32_t *point = vocab_point (m->base.v, w);
 
   while (code > 1) {
     j = point[0] * sl;
@@ -216,7 +218,7 @@ train_bag_of_words (struct nn *restrict m, struct sentence *restrict s)
       continue;
     for (c = 0; c < sl; c++)
       m->neu1[c] /= (float) d;
-    hierarchical_softmax (m, m->base.v->entries + s->words[i]);
+    hierarchical_softmax (m, s->words[i]);
     // hidden -> in
     for (a = b; a < sw * 2 + 1 - b; a++) {
       if (a == sw)
@@ -292,3 +294,36 @@ nn_verify (struct model *base)
   base->size.layer = base->size.vector;
   return 0;
 }
+
+/**
+ * The input vectors move with their words, new words get random vectors as
+ * in nn_alloc. The output vectors belong to the inner nodes of the Huffman
+ * tree, which gets rebuilt for the new vocab, so they start from zero again.
+ */
+int
+nn_remap (struct model *base, const size_t *map, size_t len)
+{
+  struct nn *m = (struct nn *) base;
+  const size_t sl = base->size.layer;
+  float *syn0;
+  float *syn1;
+  size_t i;
+  size_t j;
+
+  syn0 = model_remaprows (m->syn0, map, len, sl);
+  syn1 = mem_alloc (len * sl + 1, sizeof (float));
+  if ((syn0 == NULL) || (syn1 == NULL)) {
+    mem_free (syn0);
+    mem_free (syn1);
+    return -1;
+  }
+  for (i = 0; i < len; i++)
+    if (map[i] == SIZE_MAX)
+      for (j = 0; j < sl; j++)
+        syn0[i * sl + j] = (float) (drand48 () - 0.5) / (float) sl;
+  mem_free (m->syn0);
+  mem_free (m->syn1);
+  m->syn0 = syn0;
+  m->syn1 = syn1;
+  return 0;
+}
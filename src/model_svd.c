@@ -23,6 +23,7 @@ int svd_alloc (struct model *);
 int svd_train (struct model *, struct corpus *);
 int svd_generate (struct model *);
 int svd_verify (struct model *);
+int svd_remap (struct model *, const size_t *, size_t);
 
 const struct model_interface interface_svd = {
   .size = sizeof (struct svd),
@@ -34,6 +35,7 @@ const struct model_interface interface_svd = {
   .train = svd_train,
   .generate = svd_generate,
   .verify = svd_verify,
+  .remap = svd_remap,
 };
 
 int
@@ -103,7 +105,7 @@ train (struct svd *restrict m, struct sentence *restrict s)
         continue;
       k = i + j - sw;
       if (inrange (k, 0, (long long) s->len))
-        m->cnt[x + (m->base.v->entries[s->words[k]].hash % sl)] += 1.0 / fabs ((float) (k - i));
+        m->cnt[x + (m->base.v->hash[s->words[k]] % sl)] += 1.0 / fabs ((float) (k - i));
     }
   }
 }
@@ -165,3 +167,21 @@ svd_verify (struct model *base)
     warning ("consider using a larger layer size (>= %zu)", 4 * base->size.vector);
   return 0;
 }
+
+/**
+ * The rows of the counts belong to words and move with them, new words start
+ * without counts. The columns are buckets of word hashes, which don't change.
+ */
+int
+svd_remap (struct model *base, const size_t *map, size_t len)
+{
+  struct svd *m = (struct svd *) base;
+  float *cnt;
+
+  cnt = model_remaprows (m->cnt, map, len, base->size.layer);
+  if (cnt == NULL)
+    return -1;
+  mem_free (m->cnt);
+  m->cnt = cnt;
+  return 0;
+}
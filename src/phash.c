@@ -0,0 +1,220 @@
+#include "config.h"
+#include "phash.h"
+#include "macros.h"
+#include "mem.h"
+
+#include <string.h>
+
+/**
+ * Number of seeds tried per bucket before the table gets enlarged.
+ */
+#define PHASH_TRIES 65536
+
+struct bucket {
+  uint32_t index;
+  uint32_t len;
+  uint32_t off;
+};
+
+uint64_t
+phash_hash (const char *w, size_t n)
+{
+  uint64_t h = 14695981039346656037ull;
+
+  while (n--)
+    h = (h ^ (uint8_t) *w++) * 1099511628211ull;
+  return h;
+}
+
+static uint32_t
+pow2 (size_t n)
+{
+  uint32_t r = 1;
+
+  while (r < n)
+    r <<= 1;
+  return r;
+}
+
+static int
+cmp (const void *a, const void *b)
+{
+  const struct bucket *x = (const struct bucket *) a;
+  const struct bucket *y = (const struct bucket *) b;
+
+  return (x->len < y->len) - (x->len > y->len);
+}
+
+/**
+ * Finds a seed for every bucket, largest buckets first. Members holds the
+ * word indices sorted by bucket. Returns -1 if some bucket can't be placed.
+ */
+static int
+place (struct phash *p, uint32_t *seeds, const char **keys, const char *const *words,
+    const uint64_t *hash, const uint32_t *members, const struct bucket *b, uint32_t *tmp)
+{
+  uint32_t seed;
+  uint32_t i;
+  uint32_t j;
+  uint32_t k;
+  uint32_t s;
+
+  for (i = 0; (i < p->buckets) && (b[i].len > 0); i++) {
+    for (seed = 0; seed < PHASH_TRIES; seed++) {
+      seeds[b[i].index] = seed;
+      for (j = 0; j < b[i].len; j++) {
+        s = phash_slot (p, hash[members[b[i].off + j]]);
+        if (keys[s])
+          break;
+        for (k = 0; (k < j) && (tmp[k] != s); k++);
+        if (k < j)
+          break;
+        tmp[j] = s;
+      }
+      if (j == b[i].len)
+        break;
+    }
+    if (seed == PHASH_TRIES)
+      return -1;
+    for (j = 0; j < b[i].len; j++)
+      keys[tmp[j]] = words[members[b[i].off + j]];
+  }
+  return 0;
+}
+
+/**
+ * Builds a perfect hash set of the n words. Duplicates are ignored.
+ */
+int
+phash_build (struct phash *p, const char *const *words, size_t n)
+{
+  struct bucket *b = NULL;
+  const char **keys = NULL;
+  uint32_t *members = NULL;
+  uint32_t *seeds = NULL;
+  uint32_t *tmp = NULL;
+  uint64_t *hash = NULL;
+  size_t i;
+  size_t j;
+  size_t k;
+  char *w;
+
+  memset (p, 0, sizeof (struct phash));
+  if (n >= UINT32_MAX / 4)
+    return -1;
+  p->buckets = pow2 (max (n / 4, 1));
+  p->slots = pow2 (max (n * 2, 8));
+
+  hash = mem_alloc (n + 1, sizeof (uint64_t));
+  members = mem_alloc (n + 1, sizeof (uint32_t));
+  tmp = mem_alloc (n + 1, sizeof (uint32_t));
+  if ((hash == NULL) || (members == NULL) || (tmp == NULL))
+    goto error;
+  for (i = 0; i < n; i++)
+    hash[i] = phash_hash (words[i], strlen (words[i]));
+
+  for (;;) {
+    b = mem_alloc (p->buckets, sizeof (struct bucket));
+    seeds = mem_alloc (p->buckets, sizeof (uint32_t));
+    keys = mem_alloc (p->slots, sizeof (const char *));
+    if ((b == NULL) || (seeds == NULL) || (keys == NULL))
+      goto error;
+    p->seeds = seeds;
+
+    /* Sort the words by bucket, dropping duplicates on the way. */
+    for (i = 0; i < p->buckets; i++)
+      b[i].index = (uint32_t) i;
+    for (i = 0; i < n; i++)
+      b[(hash[i] >> 32) & (p->buckets - 1)].len++;
+    for (i = 0, k = 0; i < p->buckets; k += b[i++].len)
+      b[i].off = (uint32_t) k;
+    for (i = 0; i < p->buckets; i++)
+      b[i].len = 0;
+    for (i = 0; i < n; i++) {
+      k = (hash[i] >> 32) & (p->buckets - 1);
+      for (j = 0; j < b[k].len; j++)
+        if (strcmp (words[members[b[k].off + j]], words[i]) == 0)
+          break;
+      if (j == b[k].len)
+        members[b[k].off + b[k].len++] = (uint32_t) i;
+    }
+    qsort (b, p->buckets, sizeof (struct bucket), cmp);
+
+    if (place (p, seeds, keys, words, hash, members, b, tmp) == 0)
+      break;
+    mem_free (b);
+    mem_free (seeds);
+    mem_free (keys);
+    b = NULL;
+    seeds = NULL;
+    keys = NULL;
+    p->slots <<= 1;
+    if (p->slots == 0)
+      goto error;
+  }
+
+  /* The set owns copies of the words. */
+  for (i = 0; i < p->slots; i++) {
+    if (keys[i] == NULL)
+      continue;
+    w = strdup (keys[i]);
+    if (w == NULL) {
+      while (i--)
+        if (keys[i])
+          free ((char *) keys[i]);
+      goto error;
+    }
+    keys[i] = w;
+  }
+  p->seeds = seeds;
+  p->keys = keys;
+  mem_free (b);
+  mem_free (tmp);
+  mem_free (members);
+  mem_free (hash);
+  return 0;
+error:
+  if (b)
+    mem_free (b);
+  if (seeds)
+    mem_free (seeds);
+  if (keys)
+    mem_free (keys);
+  if (tmp)
+    mem_free (tmp);
+  if (members)
+    mem_free (members);
+  if (hash)
+    mem_free (hash);
+  memset (p, 0, sizeof (struct phash));
+  return -1;
+}
+
+/**
+ * Frees a set made by phash_build. Generated sets must not be freed.
+ */
+void
+phash_free (struct phash *p)
+{
+  size_t i;
+
+  if (p->keys == NULL)
+    return;
+  for (i = 0; i < p->slots; i++)
+    if (p->keys[i])
+      free ((char *) p->keys[i]);
+  mem_free ((void *) p->keys);
+  mem_free ((void *) p->seeds);
+  memset (p, 0, sizeof (struct phash));
+}
+
+bool
+phash_contains (const struct phash *p, const char *w, size_t n)
+{
+  const char *k;
+
+  if (p->slots == 0)
+    return false;
+  k = p->keys[phash_slot (p, phash_hash (w, n))];
+  return (k != NULL) && (strncmp (k, w, n) == 0) && (k[n] == '\0');
+}
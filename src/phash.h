@@ -0,0 +1,47 @@
+#ifndef TECTOR_PHASH_H
+#define TECTOR_PHASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Phash is a perfect hash set of strings. Keys are spread over buckets, and
+ * every bucket has a seed that maps its keys to distinct slots. A lookup
+ * takes one hash and one string compare.
+ *
+ * The arrays are plain data, so sets can be generated at build time and
+ * compiled in as constants.
+ */
+struct phash {
+  uint32_t buckets;
+  uint32_t slots;
+  const uint32_t *seeds;
+  const char *const *keys;
+};
+
+int phash_build (struct phash *p, const char *const *words, size_t n);
+void phash_free (struct phash *p);
+
+uint64_t phash_hash (const char *w, size_t n);
+
+/**
+ * Returns the slot of the word with hash h. Bucket and slot count are powers
+ * of two.
+ */
+static inline uint32_t
+phash_slot (const struct phash *p, uint64_t h)
+{
+  uint32_t x = (uint32_t) h ^ p->seeds[(h >> 32) & (p->buckets - 1)];
+
+  x ^= x >> 16;
+  x *= 0x85ebca6bu;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35u;
+  x ^= x >> 16;
+  return x & (p->slots - 1);
+}
+
+bool phash_contains (const struct phash *p, const char *w, size_t n);
+
+#endif
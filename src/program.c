@@ -16,10 +16,18 @@ extern struct program program;
   [(c) - 'a'] = {n, a, NULL, c}
 
 static struct option options[32] = {
+  makeoption ('b', "bundle", required_argument),
+  makeoption ('c', "cap", required_argument),
+  makeoption ('d', "dedup", required_argument),
+  makeoption ('f', "format", required_argument),
   makeoption ('h', "help", no_argument),
   makeoption ('i', "iterations", required_argument),
+  makeoption ('j', "jobs", required_argument),
   makeoption ('l', "layers", required_argument),
   makeoption ('m', "mincount", required_argument),
+  makeoption ('n', "max-words", required_argument),
+  makeoption ('r', "raw", no_argument),
+  makeoption ('s', "stopwords", required_argument),
   makeoption ('t', "type", required_argument),
   makeoption ('v', "vector", required_argument),
   makeoption ('w', "window", required_argument),
@@ -0,0 +1,363 @@
+#include "config.h"
+#include "queue.h"
+#include "scanner.h"
+#include "log.h"
+#include "mem.h"
+#include "macros.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * queue_split cuts the files into about SPLIT_PARTS ranges per thread, but
+ * no range gets smaller than SPLIT_MIN bytes.
+ */
+#define SPLIT_PARTS 4
+#define SPLIT_MIN (16 << 20)
+
+struct queue *
+queue_new (void)
+{
+  struct queue *q;
+
+  q = mem_alloc (1, sizeof (struct queue));
+  if (q == NULL)
+    return NULL;
+  pthread_mutex_init (&q->lock, NULL);
+  return q;
+}
+
+void
+queue_free (struct queue *q)
+{
+  size_t i;
+
+  for (i = 0; i < q->len; i++)
+    free (q->entries[i].path);
+  if (q->entries)
+    mem_free (q->entries);
+  if (q->seen.ptr)
+    mem_free (q->seen.ptr);
+  pthread_mutex_destroy (&q->lock);
+  mem_free (q);
+}
+
+static int
+append (struct queue *q, const char *path, size_t size)
+{
+  if (q->len >= q->cap) {
+    q->cap = reqcap (q->len + 1, q->cap, 64);
+    q->entries = mem_realloc (q->entries, q->cap, sizeof (struct queue_entry));
+    if (q->entries == NULL)
+      return -1;
+  }
+  q->entries[q->len].path = strdup (path);
+  if (q->entries[q->len].path == NULL)
+    return -1;
+  q->entries[q->len].size = size;
+  q->entries[q->len].begin = 0;
+  q->entries[q->len].end = SIZE_MAX;
+  q->len++;
+  return 0;
+}
+
+static size_t
+slot (const struct queue *q, dev_t dev, ino_t ino)
+{
+  size_t i = (size_t) (((uint64_t) ino ^ ((uint64_t) dev << 32)) * 0x9e3779b97f4a7c15ull) & q->seen.mask;
+
+  while ((q->seen.ptr[i].used) && ((q->seen.ptr[i].dev != dev) || (q->seen.ptr[i].ino != ino)))
+    i = (i + 1) & q->seen.mask;
+  return i;
+}
+
+/**
+ * Returns 1 if the file s was added before and remembers it otherwise, or -1
+ * if memory runs out. Files and directories that can be reached through
+ * several symbolic links only get added once, which also ends loops.
+ */
+static int
+seen (struct queue *q, const struct stat *s)
+{
+  struct queue_inode *old = q->seen.ptr;
+  size_t n = old ? q->seen.mask + 1 : 0;
+  size_t i;
+
+  /* The table doubles once it is half full. */
+  if (q->seen.len * 2 >= n) {
+    q->seen.ptr = mem_alloc (max (n * 2, 1024), sizeof (struct queue_inode));
+    if (q->seen.ptr == NULL) {
+      q->seen.ptr = old;
+      return -1;
+    }
+    q->seen.mask = max (n * 2, 1024) - 1;
+    for (i = 0; i < n; i++)
+      if (old[i].used)
+        q->seen.ptr[slot (q, old[i].dev, old[i].ino)] = old[i];
+    if (old)
+      mem_free (old);
+  }
+  i = slot (q, s->st_dev, s->st_ino);
+  if (q->seen.ptr[i].used)
+    return 1;
+  q->seen.ptr[i] = (struct queue_inode) { s->st_dev, s->st_ino, true };
+  q->seen.len++;
+  return 0;
+}
+
+/**
+ * Entries below a directory that can't be read get skipped with a warning,
+ * so that a dangling link doesn't cut the walk short. Paths given by the
+ * caller fail instead.
+ */
+static int
+skip (const char *path, bool top)
+{
+  if (top)
+    return -1;
+  warning ("skipping '%s': %s", path, strerror (errno));
+  return 0;
+}
+
+static int
+add_path (struct queue *q, const char *path, bool top);
+
+static int
+add_dir (struct queue *q, const char *path, DIR *d)
+{
+  struct dirent *e;
+  char *p;
+  int r = 0;
+
+  while (e = readdir (d), e != NULL) {
+    /* Skip hidden files as well as . and .. entries. */
+    if (e->d_name[0] == '.')
+      continue;
+    if (asprintf (&p, "%s/%s", path, e->d_name) == -1) {
+      r = -1;
+      break;
+    }
+    r = add_path (q, p, false);
+    free (p);
+    if (r != 0)
+      break;
+  }
+  closedir (d);
+  return r;
+}
+
+/**
+ * Adds the file or directory path. Only running out of memory and failing
+ * paths given by the caller, which top is true for, return -1.
+ */
+static int
+add_path (struct queue *q, const char *path, bool top)
+{
+  struct stat s;
+  DIR *d;
+  int r;
+
+  if (stat (path, &s) != 0)
+    return skip (path, top);
+  r = seen (q, &s);
+  if (r != 0)
+    return (r < 0) ? -1 : 0;
+  if (!S_ISDIR (s.st_mode))
+    return append (q, path, (size_t) s.st_size);
+  d = opendir (path);
+  if (d == NULL)
+    return skip (path, top);
+  return add_dir (q, path, d);
+}
+
+/**
+ * Adds the paths listed in the file path, one per line.
+ */
+static int
+add_list (struct queue *q, const char *path)
+{
+  struct scanner *s;
+  const char *l;
+  char *p;
+  size_t n;
+  int r;
+
+  s = scanner_open (path, NULL);
+  if (s == NULL)
+    return -1;
+  while (r = scanner_readslice (s, &l, &n), r == 0) {
+    if (n == 0)
+      continue;
+    p = strndup (l, n);
+    if ((p == NULL) || (add_path (q, p, true) != 0)) {
+      free (p);
+      break;
+    }
+    free (p);
+  }
+  scanner_free (s);
+  return -(r != -1);
+}
+
+static int
+cmp (const void *a, const void *b)
+{
+  const struct queue_entry *x = (const struct queue_entry *) a;
+  const struct queue_entry *y = (const struct queue_entry *) b;
+
+  return (x->size < y->size) - (x->size > y->size);
+}
+
+/**
+ * Adds a file, all files below a directory, or the paths listed in a file
+ * if arg starts with @. A single - stands for stdin, which is handed out
+ * first since its size is unknown.
+ */
+int
+queue_add (struct queue *q, const char *arg)
+{
+  int r;
+
+  if (strcmp (arg, "-") == 0)
+    r = append (q, arg, SIZE_MAX);
+  else if (arg[0] == '@')
+    r = add_list (q, arg + 1);
+  else
+    r = add_path (q, arg, true);
+  qsort (q->entries + q->pos, q->len - q->pos, sizeof (struct queue_entry), cmp);
+  return r;
+}
+
+/**
+ * Splits the large files that weren't handed out yet into ranges of lines,
+ * so that n threads get parts of similar size even from a single file. Only
+ * files that scanner_split accepts get split, the others stay whole.
+ */
+int
+queue_split (struct queue *q, size_t n, const struct scanner_options *o)
+{
+  struct queue_entry *e;
+  size_t *bounds;
+  size_t total = 0;
+  size_t chunk;
+  size_t len;
+  size_t i;
+  size_t j;
+  size_t k;
+  int r = 0;
+
+  len = q->len;
+  for (i = q->pos; i < len; i++)
+    if (q->entries[i].size != SIZE_MAX)
+      total += q->entries[i].size;
+  n = max (n, 1) * SPLIT_PARTS;
+  chunk = max (total / n, SPLIT_MIN);
+  bounds = mem_alloc (n + 1, sizeof (size_t));
+  if (bounds == NULL)
+    return -1;
+  for (i = q->pos; (i < len) && (r == 0); i++) {
+    e = &q->entries[i];
+    if ((e->size == SIZE_MAX) || (e->size <= chunk) || (e->end != SIZE_MAX))
+      continue;
+    k = min ((e->size + chunk - 1) / chunk, n);
+    if (scanner_split (e->path, k, bounds, o) != 0)
+      continue;
+    e->end = bounds[1];
+    e->size = bounds[1];
+    for (j = 1; j < k; j++) {
+      if (bounds[j] == bounds[j + 1])
+        continue;
+      r = append (q, q->entries[i].path, bounds[j + 1] - bounds[j]);
+      if (r != 0)
+        break;
+      q->entries[q->len - 1].begin = bounds[j];
+      q->entries[q->len - 1].end = bounds[j + 1];
+    }
+  }
+  mem_free (bounds);
+  qsort (q->entries + q->pos, q->len - q->pos, sizeof (struct queue_entry), cmp);
+  return r;
+}
+
+/**
+ * Returns the largest entry that wasn't handed out yet, or NULL if the queue
+ * is empty.
+ */
+const struct queue_entry *
+queue_pop (struct queue *q)
+{
+  const struct queue_entry *e = NULL;
+
+  pthread_mutex_lock (&q->lock);
+  if (q->pos < q->len)
+    e = &q->entries[q->pos++];
+  pthread_mutex_unlock (&q->lock);
+  return e;
+}
+
+/**
+ * Returns a scanner with the options o for the file or range of e.
+ */
+struct scanner *
+queue_open (const struct queue_entry *e, const struct scanner_options *o)
+{
+  if ((e->begin == 0) && (e->end == SIZE_MAX))
+    return scanner_open (e->path, o);
+  return scanner_open_range (e->path, e->begin, e->end, o);
+}
+
+struct worker {
+  pthread_t thread;
+  struct queue *q;
+  void (*fn) (void *, const struct queue_entry *);
+  void *arg;
+};
+
+static void *
+work (void *arg)
+{
+  struct worker *w = arg;
+  const struct queue_entry *e;
+
+  while (e = queue_pop (w->q), e != NULL)
+    w->fn (w->arg, e);
+  return NULL;
+}
+
+/**
+ * Works through the queue with n threads. Each thread calls fn with its own
+ * element of args and each entry it takes from the queue. The calling thread
+ * acts as the first thread.
+ */
+int
+queue_run (struct queue *q, size_t n, void (*fn) (void *, const struct queue_entry *), void **args)
+{
+  struct worker *w;
+  size_t i;
+  int r = 0;
+
+  w = mem_alloc (n, sizeof (struct worker));
+  if (w == NULL)
+    return -1;
+  for (i = 0; i < n; i++) {
+    w[i].q = q;
+    w[i].fn = fn;
+    w[i].arg = args[i];
+  }
+  for (i = 1; i < n; i++) {
+    if (pthread_create (&w[i].thread, NULL, work, &w[i]) != 0) {
+      r = -1;
+      break;
+    }
+  }
+  n = i;
+  work (&w[0]);
+  for (i = 1; i < n; i++)
+    pthread_join (w[i].thread, NULL);
+  mem_free (w);
+  return r;
+}
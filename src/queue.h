@@ -0,0 +1,59 @@
+#ifndef TECTOR_QUEUE_H
+#define TECTOR_QUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "scanner.h"
+
+/**
+ * Queue is a list of input files that several threads can work through.
+ * Directories are added recursively and arguments starting with @ name
+ * files that list one path per line. Symbolic links are followed, but every
+ * file and directory gets added only once, no matter how many paths lead to
+ * it. Larger files are handed out first, so that no thread ends up with a
+ * huge file while all others are idle.
+ *
+ * Entries can also be byte ranges [begin,end[ of a file, see queue_split.
+ * Whole files have the range [0,SIZE_MAX[.
+ */
+struct queue_entry {
+  char *path;
+  size_t size;
+  size_t begin;
+  size_t end;
+};
+
+/**
+ * Device and inode of a file or directory that was added.
+ */
+struct queue_inode {
+  dev_t dev;
+  ino_t ino;
+  bool used;
+};
+
+struct queue {
+  pthread_mutex_t lock;
+  size_t pos;
+  size_t len;
+  size_t cap;
+  struct queue_entry *entries;
+  struct {
+    struct queue_inode *ptr;
+    size_t len;
+    size_t mask;
+  } seen;
+};
+
+struct queue *queue_new (void);
+void queue_free (struct queue *q);
+int queue_add (struct queue *q, const char *arg);
+int queue_split (struct queue *q, size_t n, const struct scanner_options *o);
+const struct queue_entry *queue_pop (struct queue *q);
+struct scanner *queue_open (const struct queue_entry *e, const struct scanner_options *o);
+int queue_run (struct queue *q, size_t n, void (*fn) (void *, const struct queue_entry *), void **args);
+
+#endif
@@ -1,88 +1,322 @@
 #include "config.h"
 #include "scanner.h"
+#include "classify.h"
+#include "filter.h"
 #include "string.h"
 #include "mem.h"
+#include "macros.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
 
+#define BUFFER_SIZE 65536
+
+/**
+ * Reads more data into the buffer. The unprocessed bytes at the end of the
+ * buffer are moved to its front first, so that a line spanning multiple reads
+ * stays contiguous. If the buffer is full of unprocessed bytes, its capacity
+ * gets doubled. Returns -1 at the end of the input and -2 on errors. Mapped
+ * files have nothing left to fetch.
+ */
 static int
 fetch (struct scanner *s)
 {
+  unsigned char *data;
   ssize_t r;
 
+  if (s->map.ptr)
+    return -1;
+
+  s->len -= s->pos;
+  memmove (s->data, s->data + s->pos, s->len);
+  s->pos = 0;
+
+  if (s->len == s->cap) {
+    data = mem_realloc (s->data, s->cap << 1, 1);
+    if (data == NULL)
+      return -2;
+    s->data = data;
+    s->cap <<= 1;
+  }
+
   for (;;) {
-    if (r = read (s->fd, s->data, sizeof (s->data)), r <= 0) {
-      if ((r == -1) && (errno == EINTR))
+    if (s->decoder)
+      r = decoder_read (s->decoder, s->data + s->len, s->cap - s->len);
+    else if (s->ring)
+      r = uring_read (s->ring, s->data + s->len, s->cap - s->len);
+    else
+      r = read (s->fd, s->data + s->len, s->cap - s->len);
+    if (r < 0) {
+      if (errno == EINTR)
         continue;
-      return -1;
+      /* Descriptors set to non-blocking wait here instead of spinning. */
+      if ((errno == EAGAIN) && (poll (&(struct pollfd) { .fd = s->fd, .events = POLLIN }, 1, -1) >= 0))
+        continue;
+      return -2;
     }
+    if (r == 0)
+      return -1;
     break;
   }
-  s->len = (size_t) r;
-  s->pos = 0;
+  s->len += (size_t) r;
   return 0;
 }
 
-static inline bool
-endofbuffer (struct scanner *s)
+static struct scanner *
+alloc (int fd)
 {
-  return (s->pos >= s->len);
+  struct scanner *s;
+
+  if (fcntl (fd, F_GETFD) != 0)
+    return NULL;
+  s = mem_alloc (sizeof (struct scanner), 1);
+  if (s == NULL)
+    return NULL;
+  s->data = mem_alloc (BUFFER_SIZE, 1);
+  if (s->data == NULL) {
+    mem_free (s);
+    return NULL;
+  }
+  s->cap = BUFFER_SIZE;
+  s->fd = fd;
+  return s;
 }
 
-static inline bool
-endoffile (struct scanner *s)
+/**
+ * Reads the first bytes of the input and sets up how the rest gets read.
+ * Compressed input is told from the bytes in the buffer, which then go to
+ * the decoder, so that detection works on pipes without seeking. Everything
+ * else keeps the bytes and reads on through io_uring if possible. Errors of
+ * the first read are left to the next one, which reports them.
+ */
+static int
+start (struct scanner *s)
 {
-  return endofbuffer (s) && fetch (s);
+  ssize_t r;
+
+  do {
+    r = read (s->fd, s->data + s->len, s->cap - s->len);
+    if (r > 0)
+      s->len += (size_t) r;
+  } while (((r > 0) && (decoder_partial (s->data, s->len))) || ((r < 0) && (errno == EINTR)));
+
+  if (!decoder_detect (s->data, s->len)) {
+    s->ring = uring_new (s->fd);
+    return 0;
+  }
+  s->decoder = decoder_new (s->fd, s->data, s->len);
+  s->len = 0;
+  return -(s->decoder == NULL);
 }
 
-static inline int
-get (struct scanner *s)
+/**
+ * Returns a scanner that reads fd, decompressing it if it's compressed.
+ */
+struct scanner *
+scanner_new (int fd)
 {
-  if (endoffile (s))
-    return -1;
-  return s->data[s->pos++];
+  struct scanner *s;
+
+  s = alloc (fd);
+  if (s == NULL)
+    return NULL;
+  if (start (s) != 0) {
+    /* The caller still owns fd. */
+    s->fd = -1;
+    scanner_free (s);
+    return NULL;
+  }
+  return s;
 }
 
-static inline int
-peek (struct scanner *s)
+/**
+ * Returns a scanner that reads the regular file fd from a read-only mapping,
+ * or NULL if fd can't be mapped or is compressed. The caller should fall back
+ * to scanner_new in this case.
+ */
+struct scanner *
+scanner_map (int fd)
 {
-  if (endoffile (s))
+  struct scanner *s;
+  struct stat st;
+  void *ptr;
+
+  if (fstat (fd, &st) != 0)
+    return NULL;
+  if (!S_ISREG (st.st_mode) || (st.st_size <= 0))
+    return NULL;
+
+  ptr = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (ptr == MAP_FAILED)
+    return NULL;
+  if (decoder_detect (ptr, (size_t) st.st_size)) {
+    munmap (ptr, (size_t) st.st_size);
+    return NULL;
+  }
+  madvise (ptr, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+  s = mem_alloc (sizeof (struct scanner), 1);
+  if (s == NULL) {
+    munmap (ptr, (size_t) st.st_size);
+    return NULL;
+  }
+  s->fd = fd;
+  s->map.ptr = ptr;
+  s->map.len = (size_t) st.st_size;
+  s->data = ptr;
+  s->len = s->map.len;
+  s->cap = s->map.len;
+  return s;
+}
+
+/**
+ * Applies the options o, which may be NULL, to the scanner s of path.
+ */
+static int
+configure (struct scanner *s, const char *path, const struct scanner_options *o)
+{
+  if ((o) && (o->format))
+    s->adapter = *o->format;
+  else if (adapter_init (&s->adapter, path) != 0)
     return -1;
-  return s->data[s->pos];
+  s->dedup = o ? o->dedup : NULL;
+  s->filter = o ? o->filter : false;
+  return 0;
 }
 
+/**
+ * Returns a scanner for path, which can be compressed, or for stdin if path
+ * is "-". Pass NULL as o for plain text with the default settings.
+ */
 struct scanner *
-scanner_new (int fd)
+scanner_open (const char *path, const struct scanner_options *o)
 {
   struct scanner *s;
+  int fd;
 
-  if (fcntl (fd, F_GETFD) != 0)
+  /* The scanner owns its descriptor, so stdin gets duplicated. */
+  if (strcmp (path, "-") == 0)
+    fd = dup (STDIN_FILENO);
+  else
+    fd = open (path, O_RDONLY);
+  if (fd < 0)
     return NULL;
-  s = mem_alloc (sizeof (struct scanner), 1);
+  s = scanner_map (fd);
   if (s == NULL)
+    s = scanner_new (fd);
+  if (s == NULL) {
+    close (fd);
     return NULL;
-  s->fd = fd;
+  }
+  if (configure (s, path, o) != 0) {
+    scanner_free (s);
+    return NULL;
+  }
   return s;
 }
 
+/**
+ * Returns the start of the first line that starts at or after off. Lines
+ * belong to the range that contains their first byte.
+ */
+static size_t
+snap (const unsigned char *data, size_t len, size_t off)
+{
+  const unsigned char *nl;
+
+  if (off == 0)
+    return 0;
+  if (off >= len)
+    return len;
+  nl = memchr (data + off - 1, '\n', len - off + 1);
+  if (nl == NULL)
+    return len;
+  return (size_t) (nl - data) + 1;
+}
+
+/**
+ * Returns a scanner that reads the lines of path starting in [begin,end[.
+ * Ranges that share their bounds produce every line exactly once. Only
+ * regular files support ranges, and neither compressed files nor XML input,
+ * see scanner_split.
+ */
 struct scanner *
-scanner_open (const char *path)
+scanner_open_range (const char *path, size_t begin, size_t end, const struct scanner_options *o)
 {
+  struct scanner *s;
   int fd;
 
   fd = open (path, O_RDONLY);
   if (fd < 0)
     return NULL;
-  return scanner_new (fd);
+  s = scanner_map (fd);
+  if (s == NULL) {
+    close (fd);
+    return NULL;
+  }
+  if ((configure (s, path, o) != 0) || (s->adapter.type == ADAPTER_XML)) {
+    scanner_free (s);
+    return NULL;
+  }
+  s->map.begin = snap (s->data, s->map.len, begin);
+  s->pos = s->map.begin;
+  s->len = max (snap (s->data, s->map.len, end), s->pos);
+  return s;
+}
+
+/**
+ * Splits path into n ranges of roughly equal size whose bounds are snapped to
+ * line starts. The range i is [bounds[i],bounds[i + 1][, so bounds must hold
+ * n + 1 elements. Compressed files can't be split, and neither can XML input,
+ * whose elements span lines.
+ */
+int
+scanner_split (const char *path, size_t n, size_t *bounds, const struct scanner_options *o)
+{
+  struct scanner *s;
+  size_t l;
+  size_t i;
+
+  if (n == 0)
+    return -1;
+  s = scanner_open (path, o);
+  if (s == NULL)
+    return -1;
+  if ((s->map.ptr == NULL) || (s->adapter.type == ADAPTER_XML)) {
+    scanner_free (s);
+    return -1;
+  }
+  l = s->map.len;
+  for (i = 0; i < n; i++)
+    bounds[i] = snap (s->data, l, i * (l / n) + min (i, l % n));
+  bounds[n] = l;
+  scanner_free (s);
+  return 0;
 }
 
 void
 scanner_free (struct scanner *s)
 {
+  if (s->map.ptr)
+    munmap (s->map.ptr, s->map.len);
+  else
+    mem_free (s->data);
+  if (s->ring)
+    uring_free (s->ring);
+  if (s->decoder)
+    decoder_free (s->decoder);
+  if (s->word.ptr)
+    mem_free (s->word.ptr);
+  if (s->text.ptr)
+    mem_free (s->text.ptr);
   if (s->fd >= 0)
     close (s->fd);
   mem_free (s);
@@ -91,62 +325,291 @@ scanner_free (struct scanner *s)
 int
 scanner_rewind (struct scanner *s)
 {
-  s->pos = 0;
+  s->line.len = 0;
+  s->line.pos = 0;
+  s->line.words = 0;
+  s->text.len = 0;
+  s->text.pos = 0;
+  s->word.len = 0;
+  s->word.pos = 0;
+  adapter_reset (&s->adapter);
+  s->pos = s->map.begin;
+  if (s->map.ptr)
+    return 0;
   s->len = 0;
-  if (lseek (s->fd, SEEK_SET, 0) < 0)
+  if (s->decoder)
+    decoder_free (s->decoder);
+  if (s->ring)
+    uring_free (s->ring);
+  s->decoder = NULL;
+  s->ring = NULL;
+  if (lseek (s->fd, 0, SEEK_SET) < 0)
     return -1;
+  return start (s);
+}
+
+/**
+ * Returns the next raw line without its newline character. The line points
+ * into the mapping or the read buffer and stays valid until the next call.
+ * Like all read functions, it returns -1 at the end of the input and -2 if
+ * reading fails, e.g. because memory ran out or the input is corrupt.
+ */
+int
+scanner_readslice (struct scanner *s, const char **ptr, size_t *l)
+{
+  unsigned char *nl;
+  size_t off = s->pos;
+  int r;
+
+  for (;;) {
+    nl = memchr (s->data + off, '\n', s->len - off);
+    if (nl)
+      break;
+    /* Don't search the carried bytes again after fetching. */
+    off = s->len - s->pos;
+    r = fetch (s);
+    if (r == -2)
+      return -2;
+    if (r != 0)
+      break;
+  }
+
+  if (nl == NULL) {
+    if (s->pos >= s->len)
+      return -1;
+    nl = s->data + s->len;
+  }
+  *ptr = (const char *) (s->data + s->pos);
+  *l = (size_t) (nl - (s->data + s->pos));
+  s->pos = min ((size_t) (nl - s->data) + 1, s->len);
+  return 0;
+}
+
+/**
+ * Returns the next line of text. Lines of structured input are extracted into
+ * the text buffer first, which can hold several lines if the extracted text
+ * contains newlines.
+ */
+static int
+extract (struct scanner *s, const char **ptr, size_t *l)
+{
+  const char *p;
+  const char *nl;
+  char *t;
+  size_t n;
+  int r;
+
+  if (s->adapter.type == ADAPTER_TEXT)
+    return scanner_readslice (s, ptr, l);
+
+  while (s->text.pos >= s->text.len) {
+    if (r = scanner_readslice (s, &p, &n), r != 0)
+      return r;
+    if (n > s->text.cap) {
+      t = mem_realloc (s->text.ptr, n, 1);
+      if (t == NULL)
+        return -2;
+      s->text.ptr = t;
+      s->text.cap = n;
+    }
+    s->text.len = adapter_extract (&s->adapter, p, n, s->text.ptr);
+    s->text.pos = 0;
+  }
+  p = s->text.ptr + s->text.pos;
+  nl = memchr (p, '\n', s->text.len - s->text.pos);
+  n = nl ? (size_t) (nl - p) : s->text.len - s->text.pos;
+  s->text.pos += n + 1;
+  *ptr = p;
+  *l = n;
   return 0;
 }
 
+/**
+ * Returns the next line of text that isn't a duplicate. Unlike readslice,
+ * the line went through the adapter, but unlike readline, it wasn't cleaned.
+ * It stays valid until the next call.
+ */
 int
-scanner_readline (struct scanner *s, char *b, size_t l)
+scanner_readtext (struct scanner *s, const char **ptr, size_t *l)
 {
-  size_t i = 0;
-  int c;
-  int n;
+  int r;
 
-  *b = '\0';
+  for (;;) {
+    if (r = extract (s, ptr, l), r != 0)
+      return r;
+    if ((s->dedup == NULL) || (!dedup_check (s->dedup, *ptr, *l)))
+      return 0;
+  }
+}
 
-  if (endoffile (s))
-    return -1;
+/**
+ * Writes the cleaned line to b. Returns the length of the cleaned line or l
+ * if the line doesn't fit into b.
+ *
+ * The line gets processed in blocks. Runs of ordinary characters between the
+ * bytes marked by classify are copied with a single memcpy.
+ */
+static size_t
+clean (char *restrict b, size_t l, const unsigned char *restrict p, size_t n)
+{
+  bool space = false;
+  uint64_t m;
+  size_t i = 0;
+  size_t j;
+  size_t k;
+  size_t r;
+  size_t w;
 
-  while (c = get (s), c >= 0) {
-    /* Discard anything that isn't ASCII. */
-    if (isunicode (c)) {
-      while (c = peek (s), (c > 0) && (isunicode (c)))
-        get (s);
-      continue;
+  for (j = 0; j < n; j += w) {
+    w = min (n - j, CLASSIFY_BLOCK);
+    if (w == CLASSIFY_BLOCK)
+      m = classify (p + j);
+    else
+      m = classify_scalar (p + j, w);
+
+    k = 0;
+    while (k < w) {
+      r = ((m >> k) == 0) ? (w - k) : (size_t) __builtin_ctzll (m >> k);
+      if (r > 0) {
+        if (i + r + space > l)
+          return l;
+        /**
+         * Collapse whitespace into a single space, which only gets written if
+         * another word follows. This way, lines never start or end with a
+         * space.
+         */
+        if (space)
+          b[i++] = ' ';
+        space = false;
+        memcpy (b + i, p + j + k, r);
+        i += r;
+        k += r;
+        if (k >= w)
+          break;
+      }
+      /* Discard anything that isn't ASCII. */
+      if (!isunicode (p[j + k]))
+        space = (i > 0);
+      k++;
     }
-    /**
-     * Ignore whitespace. If a newline is part of the processed whitespace,
-     * stop.
-     */
-    if (isspace (c)) {
-      n = (c == '\n');
-      while (c = peek (s), (c > 0) && (isspace (c)))
-        n |= (get (s) == '\n');
+  }
+  return i;
+}
+
+/**
+ * Returns the next word of the filtered token in the scratch buffer. Tokens
+ * split at dashes produce several words separated by spaces.
+ */
+static int
+pending (struct scanner *s, const char **ptr, size_t *l)
+{
+  const char *p = s->word.ptr + s->word.pos;
+  const char *sp;
+  size_t n;
+
+  sp = memchr (p, ' ', s->word.len - s->word.pos);
+  n = sp ? (size_t) (sp - p) : s->word.len - s->word.pos;
+  s->word.pos += n + 1;
+  *ptr = p;
+  *l = n;
+  s->line.words++;
+  return 0;
+}
+
+/**
+ * Returns 0 and the next word of the current line, 1 once the current line
+ * has no words left, -1 at the end of the file or -2 on errors. Lines without
+ * words don't produce a 1. The word points into the line unless it contains non-ASCII
+ * characters; these get dropped in a copy. It stays valid until the next
+ * call.
+ *
+ * Scanners with filtering enabled run every word through filterword, so raw
+ * text turns into the same words that the filter program would write.
+ */
+int
+scanner_next_token (struct scanner *s, const char **ptr, size_t *l)
+{
+  const unsigned char *p;
+  const char *q;
+  char *t;
+  size_t b;
+  size_t e;
+  size_t i;
+  bool ascii;
+  int r;
+
+  for (;;) {
+    if (s->word.pos < s->word.len)
+      return pending (s, ptr, l);
+
+    p = s->line.ptr;
+    e = s->line.pos;
+    /* Skip whitespace, then find the end of the word. */
+    while ((e < s->line.len) && isspace (p[e]))
+      e++;
+    b = e;
+    ascii = true;
+    while ((e < s->line.len) && !isspace (p[e]))
+      ascii &= !isunicode (p[e++]);
+    s->line.pos = e;
+
+    if (b < e) {
+      if ((ascii) && (!s->filter)) {
+        *ptr = (const char *) (p + b);
+        *l = e - b;
+        s->line.words++;
+        return 0;
+      }
+      /* Room for the null-terminator filterword writes. */
+      if (e - b + 1 > s->word.cap) {
+        t = mem_realloc (s->word.ptr, e - b + 1, 1);
+        if (t == NULL)
+          return -2;
+        s->word.ptr = t;
+        s->word.cap = e - b + 1;
+      }
+      for (i = 0; b < e; b++)
+        if (!isunicode (p[b]))
+          s->word.ptr[i++] = (char) p[b];
+      if ((i > 0) && (s->filter))
+        i = filterword (s->word.ptr, s->word.ptr, i);
       if (i == 0)
         continue;
-      /* Newline found? Stop. */
-      if (n)
-        break;
-      /**
-       * If there's a space already at the end of the buffer,
-       * avoid writing another.
-       */
-      if (b[i - 1] == ' ')
-        continue;
-      c = ' ';
+      s->word.pos = 0;
+      s->word.len = i;
+      return pending (s, ptr, l);
+    }
+
+    if (s->line.words > 0) {
+      s->line.words = 0;
+      return 1;
     }
-    if (i < l)
-      b[i++] = (char) c;
+    if (r = scanner_readtext (s, &q, &s->line.len), r != 0)
+      return r;
+    s->line.ptr = (const unsigned char *) q;
+    s->line.pos = 0;
   }
+}
 
-  /* Buffer can't hold line. Ignore it and return the next line. */
-  if (i >= l)
-    return scanner_readline (s, b, l);
+int
+scanner_readline (struct scanner *s, char *b, size_t l)
+{
+  const char *p;
+  size_t n;
+  size_t i;
+  int r;
 
-  /* Replace space at the end of buffer with null-terminator. */
-  nullterm (b, i);
-  return 0;
+  while (r = scanner_readtext (s, &p, &n), r == 0) {
+    i = clean (b, l, (const unsigned char *) p, n);
+    /* Buffer can't hold line. Ignore it and return the next line. */
+    if (i >= l)
+      continue;
+    /* Skip lines that were empty after cleaning. */
+    if (i == 0)
+      continue;
+    b[i] = '\0';
+    return 0;
+  }
+  *b = '\0';
+  return r;
 }
@@ -1,24 +1,95 @@
 #ifndef TECTOR_SCANNER_H
 #define TECTOR_SCANNER_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+#include "adapter.h"
+#include "decoder.h"
+#include "dedup.h"
+#include "uring.h"
+
 /**
  * Scanner reads clean lines of ASCII text from a file descriptor.
  * Non-ASCII characters and consecutive spaces will be ignored.
+ *
+ * Regular files are mapped into memory, so lines are read straight from the
+ * page cache. Everything else, e.g. pipes and stdin, is read into a buffer
+ * that grows as long as a single line doesn't fit into it. If io_uring is
+ * available, further reads stay in flight while the buffer is processed.
+ *
+ * Files compressed with gzip, xz or zstd are decompressed by a background
+ * thread while the scanner processes the previous buffers.
+ *
+ * Mapped files can also be read in byte ranges, which lets several workers
+ * scan a single file.
+ *
+ * Files opened by path pass their lines through an adapter, which extracts
+ * the text of JSONL, TSV and XML input on the fly. Their scanner_options can
+ * force the adapter, share a dedup table that makes them skip duplicate
+ * lines, and filter their words on the fly.
+ *
+ * The read functions return -1 at the end of the input and -2 if reading
+ * fails, so errors never pass for the end of a file.
  */
 struct scanner {
   int fd;
   size_t len;
   size_t pos;
-  unsigned char data[8192];
+  size_t cap;
+  unsigned char *data;
+  struct uring *ring;
+  struct decoder *decoder;
+  struct {
+    const unsigned char *ptr;
+    size_t len;
+    size_t pos;
+    size_t words;
+  } line;
+  struct {
+    char *ptr;
+    size_t cap;
+    size_t len;
+    size_t pos;
+  } word;
+  struct {
+    char *ptr;
+    size_t cap;
+    size_t len;
+    size_t pos;
+  } text;
+  struct adapter adapter;
+  struct {
+    void *ptr;
+    size_t len;
+    size_t begin;
+  } map;
+  struct dedup *dedup;
+  bool filter;
+};
+
+/**
+ * Options of scanners opened by path. A NULL format picks the adapter by the
+ * file extension, a NULL dedup keeps duplicates. Zeroed options, like passing
+ * NULL, read the file as it is.
+ */
+struct scanner_options {
+  const struct adapter *format;
+  struct dedup *dedup;
+  bool filter;
 };
 
 struct scanner *scanner_new (int fd);
-struct scanner *scanner_open (const char *path);
+struct scanner *scanner_map (int fd);
+struct scanner *scanner_open (const char *path, const struct scanner_options *o);
+struct scanner *scanner_open_range (const char *path, size_t begin, size_t end, const struct scanner_options *o);
+int scanner_split (const char *path, size_t n, size_t *bounds, const struct scanner_options *o);
 void scanner_free (struct scanner *s);
 
 int scanner_rewind (struct scanner *s);
 int scanner_readline (struct scanner *s, char *buf, size_t l);
+int scanner_readslice (struct scanner *s, const char **ptr, size_t *l);
+int scanner_readtext (struct scanner *s, const char **ptr, size_t *l);
+int scanner_next_token (struct scanner *s, const char **ptr, size_t *l);
 
 #endif
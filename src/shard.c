@@ -0,0 +1,167 @@
+#include "config.h"
+#include "shard.h"
+#include "log.h"
+#include "mem.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SHARD_MAGIC "TECTORID"
+#define SHARD_VERSION 1
+#define BUFFER_SIZE (1 << 20)
+
+static size_t
+put (char *dst, size_t x)
+{
+  size_t n = 0;
+
+  while (x >= 0x80) {
+    dst[n++] = (char) (x | 0x80);
+    x >>= 7;
+  }
+  dst[n++] = (char) x;
+  return n;
+}
+
+/**
+ * Writes the header of shards for vocab v to dst and returns its size.
+ */
+size_t
+shard_header (char *dst, struct vocab *v)
+{
+  struct shard_header h;
+
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, SHARD_MAGIC, sizeof (h.magic));
+  h.version = SHARD_VERSION;
+  h.vocab = vocab_id (v);
+  h.words = v->len;
+  memcpy (dst, &h, sizeof (h));
+  return sizeof (h);
+}
+
+/**
+ * Encodes the filtered line src of length n, i.e. words separated by single
+ * spaces, and returns the size of the record written to dst. Dst needs room
+ * for SHARD_MAX (n) bytes. Words that aren't part of the vocab are skipped.
+ */
+size_t
+shard_encode (char *dst, struct vocab *v, const char *src, size_t n)
+{
+  char *p = dst + 5;
+  size_t len = 0;
+  size_t b;
+  size_t e;
+  size_t x;
+
+  /* The ids go behind the room for the word count, then get moved. */
+  for (b = 0; b < n; b = e + 1) {
+    for (e = b; (e < n) && (src[e] != ' ') && (src[e] != '\n'); e++);
+    if ((e > b) && (vocab_findn (v, src + b, e - b, &x) == 0)) {
+      p += put (p, x);
+      len++;
+    }
+  }
+  if (len <= 1)
+    return 0;
+  e = put (dst, len);
+  memmove (dst + e, dst + 5, (size_t) (p - dst - 5));
+  return e + (size_t) (p - dst - 5);
+}
+
+/**
+ * Returns true if the file at path starts like a shard.
+ */
+bool
+shard_probe (const char *path)
+{
+  char magic[sizeof (SHARD_MAGIC) - 1];
+  bool r;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  r = (read (fd, magic, sizeof (magic)) == (ssize_t) sizeof (magic)) &&
+      (memcmp (magic, SHARD_MAGIC, sizeof (magic)) == 0);
+  close (fd);
+  return r;
+}
+
+/**
+ * Opens the shard at path, which must have been written for the vocab v.
+ */
+struct shard *
+shard_open (const char *path, struct vocab *v)
+{
+  struct shard_header h;
+  struct shard *s;
+
+  s = mem_alloc (1, sizeof (struct shard));
+  if (s == NULL)
+    return NULL;
+  s->fd = -1;
+  s->fd = open (path, O_RDONLY);
+  if (s->fd < 0)
+    goto error;
+  s->data = mem_alloc (BUFFER_SIZE, 1);
+  if (s->data == NULL)
+    goto error;
+  if (read (s->fd, &h, sizeof (h)) != (ssize_t) sizeof (h))
+    goto error;
+  if ((memcmp (h.magic, SHARD_MAGIC, sizeof (h.magic)) != 0) || (h.version != SHARD_VERSION))
+    goto error;
+  if ((h.vocab != vocab_id (v)) || (h.words != v->len)) {
+    warning ("'%s' was written for another vocab", path);
+    goto error;
+  }
+  return s;
+error:
+  shard_free (s);
+  return NULL;
+}
+
+void
+shard_free (struct shard *s)
+{
+  if (s->fd >= 0)
+    close (s->fd);
+  if (s->data)
+    mem_free (s->data);
+  mem_free (s);
+}
+
+/**
+ * Reads the next varint into x. Returns 0 on success, 1 at the end of the
+ * shard and -1 on errors, including a shard that ends within a varint.
+ */
+int
+shard_read (struct shard *s, size_t *x)
+{
+  unsigned int shift = 0;
+  size_t v = 0;
+  ssize_t r;
+  unsigned char c;
+
+  for (;;) {
+    if (s->pos == s->len) {
+      r = read (s->fd, s->data, BUFFER_SIZE);
+      if (r < 0)
+        return -1;
+      if (r == 0)
+        return (shift == 0) ? 1 : -1;
+      s->len = (size_t) r;
+      s->pos = 0;
+    }
+    c = s->data[s->pos++];
+    if (shift >= sizeof (size_t) * 8)
+      return -1;
+    v |= (size_t) (c & 0x7f) << shift;
+    shift += 7;
+    if ((c & 0x80) == 0)
+      break;
+  }
+  *x = v;
+  return 0;
+}
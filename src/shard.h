@@ -0,0 +1,44 @@
+#ifndef TECTOR_SHARD_H
+#define TECTOR_SHARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vocab.h"
+
+/**
+ * Shards hold text as vocab ids, so that training doesn't need to tokenize
+ * and look up the words again. A shard starts with a header that names the
+ * vocab it was written for, followed by one record per sentence: the number
+ * of words and their ids, all as LEB128 varints. Sentences with fewer than
+ * two known words are left out, just like the corpus does.
+ */
+struct shard_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t vocab;
+  uint64_t words;
+};
+
+struct shard {
+  int fd;
+  size_t len;
+  size_t pos;
+  unsigned char *data;
+};
+
+/**
+ * Upper bound of the bytes shard_encode writes for a line of length n.
+ */
+#define SHARD_MAX(n) (5 * ((n) / 2 + 2))
+
+size_t shard_header (char *dst, struct vocab *v);
+size_t shard_encode (char *dst, struct vocab *v, const char *src, size_t n);
+
+bool shard_probe (const char *path);
+struct shard *shard_open (const char *path, struct vocab *v);
+void shard_free (struct shard *s);
+int shard_read (struct shard *s, size_t *x);
+
+#endif
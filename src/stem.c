@@ -3,6 +3,7 @@
 #include "string.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 struct stem {
@@ -11,6 +12,18 @@ struct stem {
   char *b;
 };
 
+/**
+ * Suffix rule of steps 2 to 4: the length of the suffix, whether it must
+ * follow an 's' or 't', and the replacement as length-prefixed string.
+ */
+struct suffix {
+  uint8_t len;
+  uint8_t cond;
+  const char *to;
+};
+
+#include "suffix_table.h"
+
 static inline bool
 cons (struct stem *restrict s, size_t i)
 {
@@ -308,8 +321,64 @@ step5 (struct stem *restrict s)
     s->k -= (s->k > 0);
 }
 
-size_t
-stem (char *w)
+/**
+ * Walks the automaton from the end of the word towards its start and returns
+ * the rule of the longest matching suffix, or 0. Like ends, a match sets j.
+ */
+static inline const struct suffix *
+match (struct stem *restrict s, size_t state)
+{
+  size_t rule = 0;
+  size_t i = s->k + 1;
+  unsigned int c;
+
+  while (i-- > 0) {
+    c = (unsigned char) s->b[i] - 'a';
+    if ((c >= 26) || ((state = suffix_next[state][c]) == 0))
+      break;
+    if (suffix_accept[state])
+      rule = suffix_accept[state];
+  }
+  if (rule == 0)
+    return NULL;
+  if (suffix_rules[rule].len < s->k)
+    s->j = s->k - suffix_rules[rule].len;
+  else
+    s->j = 0;
+  return &suffix_rules[rule];
+}
+
+static inline void
+step2tab (struct stem *restrict s)
+{
+  const struct suffix *x = match (s, SUFFIX_STEP2);
+
+  if (x)
+    r (s, x->to);
+}
+
+static inline void
+step3tab (struct stem *restrict s)
+{
+  const struct suffix *x = match (s, SUFFIX_STEP3);
+
+  if (x)
+    r (s, x->to);
+}
+
+static inline void
+step4tab (struct stem *restrict s)
+{
+  const struct suffix *x = match (s, SUFFIX_STEP4);
+
+  if ((x == NULL) || (x->cond && !atjeither (s, 's', 't')))
+    return;
+  if (m (s) > 1)
+    s->k = s->j;
+}
+
+static inline size_t
+porter (char *w, bool table)
 {
   struct stem s = (struct stem) {
     0, 0, w
@@ -324,14 +393,30 @@ stem (char *w)
   if (s.k)
     step1c (&s);
   if (s.k)
-    step2 (&s);
+    table ? step2tab (&s) : step2 (&s);
   if (s.k)
-    step3 (&s);
+    table ? step3tab (&s) : step3 (&s);
   if (s.k)
-    step4 (&s);
+    table ? step4tab (&s) : step4 (&s);
   if (s.k)
     step5 (&s);
   s.k++;
   nullterm (s.b, s.k);
   return s.k;
 }
+
+size_t
+stem (char *w)
+{
+  return porter (w, false);
+}
+
+/**
+ * Stems like stem, but matches all suffixes of steps 2 to 4 in one walk over
+ * the generated suffix automaton instead of testing them one by one.
+ */
+size_t
+stemtab (char *w)
+{
+  return porter (w, true);
+}
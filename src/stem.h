@@ -4,5 +4,6 @@
 #include <stdlib.h>
 
 size_t stem (char *);
+size_t stemtab (char *);
 
 #endif
@@ -0,0 +1,84 @@
+#include "config.h"
+#include "stemcache.h"
+#include "hash.h"
+#include "stem.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The cache is direct-mapped, each word has exactly one entry it can go to.
+ * Longer words are rare enough to always get stemmed.
+ */
+#define STEMCACHE_SIZE 2048
+#define STEMCACHE_WORD 24
+
+struct entry {
+  uint8_t len;
+  uint8_t stemlen;
+  char word[STEMCACHE_WORD];
+  char stem[STEMCACHE_WORD];
+};
+
+static __thread struct {
+  size_t hits;
+  size_t lookups;
+  struct entry entries[STEMCACHE_SIZE];
+} cache;
+
+/**
+ * Process-wide counters, the threads add theirs when flushing.
+ */
+static struct {
+  size_t hits;
+  size_t lookups;
+} totals;
+
+/**
+ * Stems the word w of length n in-place like stemtab does, and returns the
+ * length of the stem.
+ */
+size_t
+stemcache_stem (char *w, size_t n)
+{
+  struct entry *e;
+  size_t l;
+
+  if ((n <= 2) || (n >= STEMCACHE_WORD))
+    return stemtab (w);
+
+  cache.lookups++;
+  e = &cache.entries[hashptr (w, n) & (STEMCACHE_SIZE - 1)];
+  if ((e->len == n) && (memcmp (e->word, w, n) == 0)) {
+    cache.hits++;
+    memcpy (w, e->stem, e->stemlen);
+    w[e->stemlen] = '\0';
+    return e->stemlen;
+  }
+  e->len = (uint8_t) n;
+  memcpy (e->word, w, n);
+  l = stemtab (w);
+  e->stemlen = (uint8_t) l;
+  memcpy (e->stem, w, l);
+  return l;
+}
+
+/**
+ * Adds the counters of the calling thread to the totals. Threads should call
+ * this before they exit.
+ */
+void
+stemcache_flush (void)
+{
+  __atomic_add_fetch (&totals.hits, cache.hits, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&totals.lookups, cache.lookups, __ATOMIC_RELAXED);
+  cache.hits = 0;
+  cache.lookups = 0;
+}
+
+void
+stemcache_stats (size_t *hits, size_t *lookups)
+{
+  *hits = __atomic_load_n (&totals.hits, __ATOMIC_RELAXED);
+  *lookups = __atomic_load_n (&totals.lookups, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,17 @@
+#ifndef TECTOR_STEMCACHE_H
+#define TECTOR_STEMCACHE_H
+
+#include <stdlib.h>
+
+/**
+ * Stemcache remembers the stems of recently seen words. Natural text repeats
+ * a few thousand words most of the time, so most words don't need to run
+ * through the stemmer. Every thread has a cache of its own, which keeps
+ * lookups free of locks.
+ */
+size_t stemcache_stem (char *w, size_t n);
+
+void stemcache_flush (void);
+void stemcache_stats (size_t *hits, size_t *lookups);
+
+#endif
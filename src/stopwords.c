@@ -1,253 +1,110 @@
-#include "stopwords.h"
 #include "config.h"
+#include "stopwords.h"
+#include "mem.h"
+#include "phash.h"
+#include "scanner.h"
+#include "string.h"
 
 #include <string.h>
 #include <stdlib.h>
 
-#define len(x) (sizeof(x) / sizeof(x[0]))
+/**
+ * The built-in set gets generated from stopwords.txt at build time.
+ */
+#include "stopwords_table.h"
+
+static const struct phash *active = &builtin;
+
+/**
+ * Loaded stopwords. The set gets rebuilt whenever a file is loaded.
+ */
+static struct phash custom;
+static struct {
+  char **ptr;
+  size_t len;
+  size_t cap;
+} words;
 
-const char *stopwords[] = {
-  "about",
-  "above",
-  "after",
-  "again",
-  "against",
-  "aint",
-  "all",
-  "also",
-  "am",
-  "an",
-  "and",
-  "any",
-  "are",
-  "arent",
-  "as",
-  "at",
-  "be",
-  "because",
-  "been",
-  "before",
-  "being",
-  "below",
-  "between",
-  "both",
-  "but",
-  "by",
-  "can",
-  "cannot",
-  "cant",
-  "clock",
-  "could",
-  "couldnt",
-  "couldntve",
-  "couldve",
-  "did",
-  "didnt",
-  "do",
-  "does",
-  "doesnt",
-  "doing",
-  "dont",
-  "down",
-  "during",
-  "each",
-  "few",
-  "for",
-  "from",
-  "further",
-  "got",
-  "had",
-  "hadnt",
-  "hadntve",
-  "has",
-  "hasnt",
-  "have",
-  "havent",
-  "having",
-  "he",
-  "hed",
-  "hedve",
-  "hell",
-  "her",
-  "here",
-  "hers",
-  "herself",
-  "hes",
-  "him",
-  "himself",
-  "his",
-  "how",
-  "howd",
-  "howll",
-  "hows",
-  "i",
-  "id",
-  "idve",
-  "if",
-  "ill",
-  "im",
-  "in",
-  "into",
-  "is",
-  "isnt",
-  "it",
-  "itd",
-  "itdve",
-  "itll",
-  "its",
-  "itself",
-  "ive",
-  "just",
-  "let",
-  "lets",
-  "maam",
-  "madam",
-  "me",
-  "might",
-  "mightnt",
-  "mightntve",
-  "mightve",
-  "more",
-  "most",
-  "mr",
-  "mrs",
-  "must",
-  "mustnt",
-  "mustve",
-  "my",
-  "myself",
-  "need",
-  "neednt",
-  "no",
-  "nor",
-  "not",
-  "notve",
-  "now",
-  "nt",
-  "oclock",
-  "of",
-  "off",
-  "on",
-  "once",
-  "only",
-  "or",
-  "other",
-  "our",
-  "ours",
-  "ourselves",
-  "out",
-  "over",
-  "own",
-  "said",
-  "same",
-  "shall",
-  "shant",
-  "she",
-  "shed",
-  "shedve",
-  "shell",
-  "shes",
-  "should",
-  "shouldnt",
-  "shouldntve",
-  "shouldve",
-  "so",
-  "some",
-  "such",
-  "than",
-  "that",
-  "thatll",
-  "thats",
-  "the",
-  "their",
-  "theirs",
-  "them",
-  "themselves",
-  "then",
-  "there",
-  "thered",
-  "theredve",
-  "therere",
-  "theres",
-  "these",
-  "they",
-  "theyd",
-  "theydve",
-  "theyll",
-  "theyre",
-  "theyve",
-  "this",
-  "those",
-  "through",
-  "to",
-  "too",
-  "under",
-  "until",
-  "up",
-  "very",
-  "was",
-  "wasnt",
-  "we",
-  "wed",
-  "wedve",
-  "well",
-  "were",
-  "werent",
-  "weve",
-  "what",
-  "whatll",
-  "whatre",
-  "whats",
-  "whatve",
-  "when",
-  "whens",
-  "where",
-  "whered",
-  "wheres",
-  "whereve",
-  "which",
-  "while",
-  "who",
-  "whod",
-  "wholl",
-  "whom",
-  "whore",
-  "whos",
-  "whove",
-  "why",
-  "whyll",
-  "whyre",
-  "whys",
-  "will",
-  "with",
-  "wont",
-  "would",
-  "wouldnt",
-  "wouldntve",
-  "wouldve",
-  "yall",
-  "yalldve",
-  "yeah",
-  "you",
-  "youd",
-  "youdve",
-  "youll",
-  "your",
-  "youre",
-  "yours",
-  "yourself",
-  "yourselves",
-  "youve",
-};
+int
+isstopword (const char *w, size_t n)
+{
+  return phash_contains (active, w, n);
+}
 
 static int
-cmp (const void *a, const void *b)
+append (const char *l, size_t n)
 {
-  return strcmp (a, *(const char *const *) b);
+  char *w;
+  size_t i;
+  size_t j;
+
+  if (words.len == words.cap) {
+    words.cap = reqcap (words.len + 1, words.cap, 256);
+    words.ptr = mem_realloc (words.ptr, words.cap, sizeof (char *));
+    if (words.ptr == NULL)
+      return -1;
+  }
+  w = malloc (n + 1);
+  if (w == NULL)
+    return -1;
+  for (i = j = 0; i < n; i++)
+    if (isalpha (l[i]))
+      w[j++] = lowercase (l[i]);
+  w[j] = '\0';
+  if (j == 0) {
+    free (w);
+    return 0;
+  }
+  words.ptr[words.len++] = w;
+  return 0;
 }
 
+/**
+ * Loads the stopwords listed in path, one per line, instead of the built-in
+ * ones. Words get reduced to lowercase letters, the way filterword sees them,
+ * and lines starting with # are ignored. Loading several files combines them.
+ */
 int
-isstopword (const char *w)
+stopwords_load (const char *path)
 {
-  return bsearch (w, stopwords, len (stopwords), sizeof (const char *), cmp) != NULL;
+  struct scanner *s;
+  const char *l;
+  size_t n;
+  int r = 0;
+
+  s = scanner_open (path, NULL);
+  if (s == NULL)
+    return -1;
+  while (r = scanner_readslice (s, &l, &n), r == 0) {
+    if ((n > 0) && (l[0] == '#'))
+      continue;
+    if (append (l, n) != 0)
+      break;
+  }
+  scanner_free (s);
+  if (r != -1)
+    return -1;
+
+  phash_free (&custom);
+  if (phash_build (&custom, (const char *const *) words.ptr, words.len) != 0)
+    return -1;
+  active = &custom;
+  return 0;
+}
+
+/**
+ * Drops loaded stopwords and returns to the built-in ones.
+ */
+void
+stopwords_reset (void)
+{
+  size_t i;
+
+  active = &builtin;
+  phash_free (&custom);
+  for (i = 0; i < words.len; i++)
+    free (words.ptr[i]);
+  if (words.ptr)
+    mem_free (words.ptr);
+  memset (&words, 0, sizeof (words));
 }
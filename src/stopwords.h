@@ -1,6 +1,15 @@
 #ifndef TECTOR_STOPWORDS_H
 #define TECTOR_STOPWORDS_H
 
-int isstopword (const char *);
+#include <stdlib.h>
+
+/**
+ * Stopwords are kept in a perfect hash set, so checking a word takes a single
+ * hash and string compare.
+ */
+int isstopword (const char *w, size_t n);
+
+int stopwords_load (const char *path);
+void stopwords_reset (void);
 
 #endif
@@ -14,8 +14,18 @@ char uppercase (int c);
 
 int ordalpha (int c);
 
+extern const char lowercasetab[256];
+
+/**
+ * Returns the lowercase form of the letter c, or 0 if c isn't a letter.
+ */
+static inline char
+lowercasealpha (int c)
+{
+  return lowercasetab[(unsigned char) c];
+}
+
 char *nullterm (char *s, size_t l);
 char *formatsize (char *s, size_t v);
-char *filter (char *s);
 
 #endif
@@ -0,0 +1,450 @@
+#include "config.h"
+#include "uring.h"
+#include "macros.h"
+#include "mem.h"
+
+#include <errno.h>
+
+#if defined(HAVE_LINUX_IO_URING_H)
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define URING_DEPTH 4
+#define URING_SIZE (1 << 20)
+
+/**
+ * User data of cancel requests. Reads use their buffer index, polls that wait
+ * for the data of a buffer have the POLL bit set as well.
+ */
+#define CANCEL ((uint64_t) -1)
+#define POLL ((uint64_t) 1 << 32)
+
+enum {
+  IDLE,
+  PENDING,
+  READY,
+  FAILED,
+};
+
+struct buffer {
+  int state;
+  int error;
+  bool eof;
+  bool polling;
+  off_t off;
+  size_t fill;
+  struct iovec iov;
+  unsigned char *data;
+};
+
+struct uring {
+  int fd;
+  int ring;
+  bool seekable;
+  bool closing;
+  off_t off;
+  size_t cur;
+  size_t pos;
+  size_t depth;
+  unsigned int features;
+  struct {
+    unsigned int *head;
+    unsigned int *tail;
+    unsigned int *mask;
+    unsigned int *array;
+    struct io_uring_sqe *sqes;
+  } sq;
+  struct {
+    unsigned int *head;
+    unsigned int *tail;
+    unsigned int *mask;
+    struct io_uring_cqe *cqes;
+  } cq;
+  struct {
+    void *ptr;
+    size_t len;
+  } maps[3];
+  struct buffer buffers[URING_DEPTH];
+};
+
+static int
+enter (struct uring *u, unsigned int submit, unsigned int wait)
+{
+  const unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+  for (;;) {
+    if (syscall (__NR_io_uring_enter, u->ring, submit, wait, flags, NULL, 0) >= 0)
+      return 0;
+    /* Interrupted while waiting. Submitted entries don't get submitted twice. */
+    if (errno != EINTR)
+      return -1;
+  }
+}
+
+static struct io_uring_sqe *
+sqe (struct uring *u)
+{
+  const unsigned int tail = *u->sq.tail;
+  const unsigned int index = tail & *u->sq.mask;
+  struct io_uring_sqe *e = &u->sq.sqes[index];
+
+  memset (e, 0, sizeof (struct io_uring_sqe));
+  u->sq.array[index] = index;
+  return e;
+}
+
+static int
+push (struct uring *u)
+{
+  __atomic_store_n (u->sq.tail, *u->sq.tail + 1, __ATOMIC_RELEASE);
+  return enter (u, 1, 0);
+}
+
+static int
+submit (struct uring *u, size_t i)
+{
+  struct buffer *b = &u->buffers[i];
+  struct io_uring_sqe *e;
+
+  b->iov.iov_base = b->data + b->fill;
+  b->iov.iov_len = URING_SIZE - b->fill;
+
+  e = sqe (u);
+  e->opcode = IORING_OP_READV;
+  e->fd = u->fd;
+  e->addr = (uint64_t) (uintptr_t) &b->iov;
+  e->len = 1;
+  e->user_data = i;
+  if (u->seekable)
+    e->off = (uint64_t) (b->off + (off_t) b->fill);
+  else
+    e->off = (uint64_t) -1;
+  b->state = PENDING;
+  b->polling = false;
+  return push (u);
+}
+
+/**
+ * Waits until fd has data for the buffer i, whose read found none. Non-blocking
+ * descriptors fail with EAGAIN instead of waiting in the read.
+ */
+static int
+watch (struct uring *u, size_t i)
+{
+  struct io_uring_sqe *e;
+
+  e = sqe (u);
+  e->opcode = IORING_OP_POLL_ADD;
+  e->fd = u->fd;
+  e->poll_events = POLLIN;
+  e->user_data = POLL | i;
+  u->buffers[i].polling = true;
+  return push (u);
+}
+
+static int
+cancel (struct uring *u, size_t i)
+{
+  struct io_uring_sqe *e;
+
+  e = sqe (u);
+  e->opcode = IORING_OP_ASYNC_CANCEL;
+  e->fd = -1;
+  e->addr = u->buffers[i].polling ? (POLL | i) : i;
+  e->user_data = CANCEL;
+  return push (u);
+}
+
+/**
+ * Handles a completed read or poll. Reads of seekable files only become ready
+ * once the buffer is full or the end of file was reached, so that the next
+ * buffer continues where this one stops. Reads that would block wait for a
+ * poll before they get submitted again.
+ */
+static void
+complete (struct uring *u, uint64_t data, int res)
+{
+  const size_t i = (size_t) (data & ~POLL);
+  struct buffer *b = &u->buffers[i];
+
+  if (u->closing) {
+    b->state = IDLE;
+    return;
+  }
+  if (data & POLL) {
+    if ((res >= 0) && (submit (u, i) == 0))
+      return;
+    if ((res == -EINTR) && (watch (u, i) == 0))
+      return;
+    res = (res < 0) ? res : -errno;
+  }
+  else if (res < 0) {
+    if ((res == -EAGAIN) && (watch (u, i) == 0))
+      return;
+    if ((res == -EINTR) && (submit (u, i) == 0))
+      return;
+    if ((res == -EAGAIN) || (res == -EINTR))
+      res = -errno;
+  }
+  if (res < 0) {
+    b->state = FAILED;
+    b->error = -res;
+    return;
+  }
+  b->fill += (size_t) res;
+  b->eof = (res == 0);
+  if ((u->seekable) && (!b->eof) && (b->fill < URING_SIZE)) {
+    if (submit (u, i) == 0)
+      return;
+    b->state = FAILED;
+    b->error = errno;
+    return;
+  }
+  b->state = READY;
+}
+
+/**
+ * Waits for at least one completion and handles all completions that are
+ * available.
+ */
+static int
+reap (struct uring *u)
+{
+  struct io_uring_cqe *e;
+  unsigned int head;
+
+  if (enter (u, 0, 1) != 0)
+    return -1;
+  head = *u->cq.head;
+  while (head != __atomic_load_n (u->cq.tail, __ATOMIC_ACQUIRE)) {
+    e = &u->cq.cqes[head & *u->cq.mask];
+    if (e->user_data != CANCEL)
+      complete (u, e->user_data, e->res);
+    head++;
+  }
+  __atomic_store_n (u->cq.head, head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static int
+setup (struct uring *u)
+{
+  struct io_uring_params p;
+  long fd;
+
+  memset (&p, 0, sizeof (p));
+  fd = syscall (__NR_io_uring_setup, URING_DEPTH * 2, &p);
+  if (fd < 0)
+    return -1;
+  u->ring = (int) fd;
+  u->features = p.features;
+
+  u->maps[0].len = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+  u->maps[1].len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  u->maps[2].len = p.sq_entries * sizeof (struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    u->maps[0].len = u->maps[1].len = max (u->maps[0].len, u->maps[1].len);
+
+  u->maps[0].ptr = mmap (NULL, u->maps[0].len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQ_RING);
+  if (u->maps[0].ptr == MAP_FAILED)
+    return -1;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    u->maps[1].ptr = u->maps[0].ptr;
+  }
+  else {
+    u->maps[1].ptr = mmap (NULL, u->maps[1].len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_CQ_RING);
+    if (u->maps[1].ptr == MAP_FAILED)
+      return -1;
+  }
+  u->maps[2].ptr = mmap (NULL, u->maps[2].len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQES);
+  if (u->maps[2].ptr == MAP_FAILED)
+    return -1;
+
+  u->sq.head = (unsigned int *) ((char *) u->maps[0].ptr + p.sq_off.head);
+  u->sq.tail = (unsigned int *) ((char *) u->maps[0].ptr + p.sq_off.tail);
+  u->sq.mask = (unsigned int *) ((char *) u->maps[0].ptr + p.sq_off.ring_mask);
+  u->sq.array = (unsigned int *) ((char *) u->maps[0].ptr + p.sq_off.array);
+  u->sq.sqes = (struct io_uring_sqe *) u->maps[2].ptr;
+  u->cq.head = (unsigned int *) ((char *) u->maps[1].ptr + p.cq_off.head);
+  u->cq.tail = (unsigned int *) ((char *) u->maps[1].ptr + p.cq_off.tail);
+  u->cq.mask = (unsigned int *) ((char *) u->maps[1].ptr + p.cq_off.ring_mask);
+  u->cq.cqes = (struct io_uring_cqe *) ((char *) u->maps[1].ptr + p.cq_off.cqes);
+  return 0;
+}
+
+/**
+ * Returns a reader for fd or NULL if io_uring isn't available. The reader
+ * starts at the current file offset of fd. Pipes and other descriptors
+ * without offset need kernels that read them at their current position,
+ * older ones are left to read(2).
+ */
+struct uring *
+uring_new (int fd)
+{
+  struct uring *u;
+  size_t i;
+
+  u = mem_alloc (1, sizeof (struct uring));
+  if (u == NULL)
+    return NULL;
+  u->fd = fd;
+  u->ring = -1;
+  for (i = 0; i < 3; i++)
+    u->maps[i].ptr = MAP_FAILED;
+
+  u->off = lseek (fd, 0, SEEK_CUR);
+  u->seekable = (u->off >= 0);
+  u->depth = u->seekable ? URING_DEPTH : 2;
+
+  for (i = 0; i < u->depth; i++) {
+    u->buffers[i].data = mem_align (URING_SIZE, 1, 4096);
+    if (u->buffers[i].data == NULL)
+      goto error;
+  }
+  if (setup (u) != 0)
+    goto error;
+  if ((!u->seekable) && (!(u->features & IORING_FEAT_RW_CUR_POS)))
+    goto error;
+
+  /**
+   * Reads of files without offset have to happen in order, so only the first
+   * read gets submitted here.
+   */
+  for (i = 0; i < u->depth; i++) {
+    u->buffers[i].off = u->off;
+    if (submit (u, i) != 0)
+      goto error;
+    u->off += URING_SIZE;
+    if (!u->seekable)
+      break;
+  }
+  return u;
+error:
+  uring_free (u);
+  return NULL;
+}
+
+/**
+ * Cancels all reads in flight and waits for them. The kernel must not write
+ * into buffers that are already freed.
+ */
+void
+uring_free (struct uring *u)
+{
+  bool pending;
+  size_t i;
+
+  if (u->ring >= 0) {
+    u->closing = true;
+    for (i = 0; i < u->depth; i++)
+      if (u->buffers[i].state == PENDING)
+        cancel (u, i);
+    for (;;) {
+      pending = false;
+      for (i = 0; i < u->depth; i++)
+        pending |= (u->buffers[i].state == PENDING);
+      if (!pending)
+        break;
+      if (reap (u) != 0)
+        break;
+    }
+  }
+  for (i = 0; i < 3; i++) {
+    if ((u->maps[i].ptr == MAP_FAILED) || ((i == 1) && (u->maps[1].ptr == u->maps[0].ptr)))
+      continue;
+    munmap (u->maps[i].ptr, u->maps[i].len);
+  }
+  if (u->ring >= 0)
+    close (u->ring);
+  for (i = 0; i < u->depth; i++)
+    if (u->buffers[i].data)
+      mem_free (u->buffers[i].data);
+  mem_free (u);
+}
+
+/**
+ * Works like read(2). Copies data of the oldest completed buffer to buf, and
+ * hands the buffer back to the kernel once it's consumed.
+ */
+ssize_t
+uring_read (struct uring *u, void *buf, size_t n)
+{
+  struct buffer *b;
+  size_t l;
+  size_t i;
+
+  for (;;) {
+    b = &u->buffers[u->cur];
+    while (b->state == PENDING)
+      if (reap (u) != 0)
+        return -1;
+    if (b->state == FAILED) {
+      errno = b->error;
+      return -1;
+    }
+    if (b->state == IDLE)
+      return 0;
+
+    /* Keep the next read in flight while this buffer is being consumed. */
+    i = (u->cur + 1) % u->depth;
+    if ((!u->seekable) && (!b->eof) && (u->buffers[i].state == IDLE))
+      if (submit (u, i) != 0)
+        return -1;
+
+    if (u->pos < b->fill) {
+      l = min (n, b->fill - u->pos);
+      memcpy (buf, b->data + u->pos, l);
+      u->pos += l;
+      return (ssize_t) l;
+    }
+    if (b->eof)
+      return 0;
+
+    b->state = IDLE;
+    b->fill = 0;
+    u->pos = 0;
+    u->cur = i;
+    if (u->seekable) {
+      b->off = u->off;
+      if (submit (u, (size_t) (b - u->buffers)) != 0)
+        return -1;
+      u->off += URING_SIZE;
+    }
+  }
+}
+
+#else
+
+struct uring *
+uring_new (int fd)
+{
+  (void) fd;
+  errno = ENOSYS;
+  return NULL;
+}
+
+void
+uring_free (struct uring *u)
+{
+  mem_free (u);
+}
+
+ssize_t
+uring_read (struct uring *u, void *buf, size_t n)
+{
+  (void) u;
+  (void) buf;
+  (void) n;
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef TECTOR_URING_H
+#define TECTOR_URING_H
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * Uring reads a file descriptor through io_uring. It keeps several reads in
+ * flight while the caller processes the data of previous ones. Seekable files
+ * get all buffers in flight at once, everything else gets one read in flight
+ * besides the buffer being consumed.
+ */
+struct uring;
+
+struct uring *uring_new (int fd);
+void uring_free (struct uring *u);
+
+ssize_t uring_read (struct uring *u, void *buf, size_t n);
+
+#endif
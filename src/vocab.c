@@ -11,8 +11,59 @@
 #include "mem.h"
 #include "hash.h"
 #include "file.h"
+#include "macros.h"
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Number of records read from files of the old layout at once.
+ */
+#define RECORDS 1024
+
+/**
+ * Vocab files store the arrays, the words and the table at offsets aligned
+ * to SECTION_ALIGN, so that they can be used right from a mapping. The
+ * frozen table and its keys come last, files without them are still valid.
+ * Files without VOCAB_LAYOUT in the header hold one vocab_entry record per
+ * word. The layout has to change whenever the table or the hash function
+ * does.
+ */
+#define VOCAB_LAYOUT 1
+#define SECTION_ALIGN 4096
+
+enum {
+  SECTION_HASH,
+  SECTION_COUNT,
+  SECTION_OFFSET,
+  SECTION_CODE,
+  SECTION_POINT,
+  SECTION_WORDS,
+  SECTION_TABLE,
+  SECTION_FROZEN,
+  SECTION_KEYS,
+  SECTIONS,
+};
+
+/**
+ * Smallest and largest number of home slots of the table, the maximum load
+ * factor, and the number of extra slots at the end.
+ */
+#define TABLE_MIN 32768
+#define TABLE_MAX (1ul << 31)
+#define TABLE_LOAD 0.7f
+#define TABLE_TAIL 64
+
+/**
+ * Pruning keeps at most PRUNE_KEEP of the limit, the counts of the pruned
+ * words are collected in PRUNE_COUNTS buckets to pick the threshold.
+ */
+#define PRUNE_KEEP 0.75f
+#define PRUNE_COUNTS 1024
 
 struct vocab *
 vocab_new (void)
@@ -32,26 +83,238 @@ error:
   return NULL;
 }
 
+/**
+ * Drops the codes and points, they get stale once the words change.
+ */
+static void
+drop_codes (struct vocab *v)
+{
+  if (v->code)
+    mem_freenull (v->code);
+  if (v->point)
+    mem_freenull (v->point);
+}
+
+/**
+ * Drops the frozen table, it gets stale once the words change.
+ */
+static void
+drop_frozen (struct vocab *v)
+{
+  if (v->map.ptr == NULL) {
+    mem_free (v->frozen.table);
+    mem_free (v->frozen.keys);
+  }
+  memset (&v->frozen, 0, sizeof (v->frozen));
+}
+
 void
 vocab_free (struct vocab *v)
 {
-  mem_free (v->entries);
+  if (v->map.ptr) {
+    munmap (v->map.ptr, v->map.len);
+    mem_free (v);
+    return;
+  }
+  drop_frozen (v);
+  drop_codes (v);
+  mem_free (v->words.ptr);
+  mem_free (v->offset);
+  mem_free (v->count);
+  mem_free (v->hash);
   mem_free (v->table);
   mem_free (v);
 }
 
+static void *
+copy (const void *p, size_t n, size_t size)
+{
+  void *r;
+
+  r = mem_alloc (n + 1, size);
+  if (r)
+    memcpy (r, p, n * size);
+  return r;
+}
+
+/**
+ * Copies the arrays of a mapped vocab to the heap before it gets changed.
+ */
+static int
+thaw (struct vocab *v)
+{
+  struct vocab w = *v;
+
+  if (v->map.ptr == NULL)
+    return 0;
+  w.hash = copy (v->hash, v->len, sizeof (uint32_t));
+  w.count = copy (v->count, v->len, sizeof (uint32_t));
+  w.offset = copy (v->offset, v->len, sizeof (uint32_t));
+  w.code = copy (v->code, v->len, sizeof (uint64_t));
+  w.point = copy (v->point, v->len, MAX_CODE_LENGTH * sizeof (int32_t));
+  w.words.ptr = copy (v->words.ptr, v->words.len, 1);
+  w.table = copy (v->table, v->cap + TABLE_TAIL, sizeof (struct vocab_slot));
+  w.map.ptr = NULL;
+  memset (&w.frozen, 0, sizeof (w.frozen));
+  if ((w.hash == NULL) || (w.count == NULL) || (w.offset == NULL) || (w.code == NULL)
+      || (w.point == NULL) || (w.words.ptr == NULL) || (w.table == NULL)) {
+    mem_free (w.hash);
+    mem_free (w.count);
+    mem_free (w.offset);
+    mem_free (w.code);
+    mem_free (w.point);
+    mem_free (w.words.ptr);
+    mem_free (w.table);
+    return -1;
+  }
+  munmap (v->map.ptr, v->map.len);
+  *v = w;
+  v->size = v->len;
+  v->words.cap = v->words.len;
+  return 0;
+}
+
+/**
+ * Makes room for n words in the word arrays.
+ */
+static int
+reserve (struct vocab *v, size_t n)
+{
+  if (n <= v->size)
+    return 0;
+  if (n >= UINT32_MAX)
+    return -1;
+  v->size = reqcap (n, v->size, 1024);
+  v->hash = mem_realloc (v->hash, v->size, sizeof (uint32_t));
+  v->count = mem_realloc (v->count, v->size, sizeof (uint32_t));
+  v->offset = mem_realloc (v->offset, v->size, sizeof (uint32_t));
+  if ((v->hash == NULL) || (v->count == NULL) || (v->offset == NULL))
+    return -1;
+  return 0;
+}
+
+/**
+ * Appends the word of length n at w to the arena and returns its offset in
+ * off.
+ */
+static int
+store (struct vocab *v, const char *w, size_t n, uint32_t *off)
+{
+  if (v->words.len + n + 1 > v->words.cap) {
+    if (v->words.len + n + 1 > UINT32_MAX)
+      return -1;
+    v->words.cap = reqcap (v->words.len + n + 1, v->words.cap, 65536);
+    v->words.ptr = mem_realloc (v->words.ptr, v->words.cap, 1);
+    if (v->words.ptr == NULL)
+      return -1;
+  }
+  memcpy (v->words.ptr + v->words.len, w, n);
+  v->words.ptr[v->words.len + n] = '\0';
+  *off = (uint32_t) v->words.len;
+  v->words.len += n + 1;
+  return 0;
+}
+
+/**
+ * Sizes the table for the words of the vocab and clears it.
+ */
 int
 vocab_alloc (struct vocab *v)
 {
-  v->cap = reqcap (v->len, v->cap, 32768);
-  v->entries = mem_realloc (v->entries, v->cap, sizeof (struct vocab_entry));
-  if (v->entries == NULL)
+  size_t cap = TABLE_MIN;
+
+  if (thaw (v) != 0)
     return -1;
-  v->table = mem_realloc (v->table, v->cap, sizeof (struct vocab_entry *));
+  drop_frozen (v);
+  while ((float) v->len > (float) cap * TABLE_LOAD)
+    cap <<= 1;
+  if (cap > TABLE_MAX)
+    return -1;
+  v->cap = cap;
+  for (v->shift = 32; cap > 1; cap >>= 1)
+    v->shift--;
+  v->table = mem_realloc (v->table, v->cap + TABLE_TAIL, sizeof (struct vocab_slot));
   if (v->table == NULL)
     return -1;
-  mem_clear (v->entries + v->len, v->cap - v->len, sizeof (struct vocab_entry));
-  mem_clear (v->table, v->cap, sizeof (struct vocab_entry *));
+  mem_clear (v->table, v->cap + TABLE_TAIL, sizeof (struct vocab_slot));
+  return reserve (v, v->len);
+}
+
+/**
+ * Returns the first slot at or after the home of h that is empty or holds a
+ * larger hash, i.e. where h goes.
+ */
+static inline size_t
+seek (const struct vocab *v, uint32_t h)
+{
+  const struct vocab_slot *t = v->table;
+  size_t i = h >> v->shift;
+
+  while ((t[i].index != 0) && (t[i].hash <= h))
+    i++;
+  return i;
+}
+
+/**
+ * Puts the slot into position i, the slots from i up to the next empty slot
+ * move one slot further. The last slot always stays empty, so that probes
+ * end there at the latest.
+ */
+static int
+place (struct vocab *v, size_t i, uint32_t h, uint32_t index)
+{
+  const size_t end = v->cap + TABLE_TAIL - 1;
+  size_t e;
+
+  for (e = i; (e < end) && (v->table[e].index != 0); e++);
+  if (e == end)
+    return -1;
+  memmove (v->table + i + 1, v->table + i, (e - i) * sizeof (struct vocab_slot));
+  v->table[i] = (struct vocab_slot) { h, index };
+  return 0;
+}
+
+/**
+ * Doubles the table in place. The slots are sorted by hash, so their homes
+ * only grow: the slots get packed at the end of the larger table, and then
+ * moved forward to their new position in one pass, which never overtakes the
+ * next packed slot.
+ */
+static int
+grow (struct vocab *v)
+{
+  const size_t old = v->cap + TABLE_TAIL;
+  const size_t end = (v->cap << 1) + TABLE_TAIL;
+  struct vocab_slot *t = v->table;
+  struct vocab_slot x;
+  size_t next;
+  size_t r;
+  size_t w;
+
+  if ((v->cap << 1) > TABLE_MAX)
+    return -1;
+  for (r = 0, next = 0; r < old; r++)
+    if (t[r].index)
+      next = max (t[r].hash >> (v->shift - 1), next) + 1;
+  if (next >= end)
+    return -1;
+
+  t = mem_realloc (t, end, sizeof (struct vocab_slot));
+  if (t == NULL)
+    return -1;
+  v->table = t;
+  for (r = old, w = end; r-- > 0;)
+    if (t[r].index)
+      t[--w] = t[r];
+  mem_clear (t, w, sizeof (struct vocab_slot));
+  v->cap <<= 1;
+  v->shift--;
+  for (r = w, next = 0; r < end; r++) {
+    x = t[r];
+    t[r] = (struct vocab_slot) { 0, 0 };
+    next = max (x.hash >> v->shift, next);
+    t[next++] = x;
+  }
   return 0;
 }
 
@@ -59,206 +322,882 @@ int
 vocab_build (struct vocab *v)
 {
   size_t i;
-  size_t j;
 
-  mem_clear (v->table, v->cap, sizeof (struct vocab_entry *));
+  if (thaw (v) != 0)
+    return -1;
+  drop_frozen (v);
+  mem_clear (v->table, v->cap + TABLE_TAIL, sizeof (struct vocab_slot));
   for (i = 0; i < v->len; i++) {
-    j = v->entries[i].hash;
-    for (;;) {
-      if (v->table[j % v->cap] == NULL)
-        break;
-      j++;
-    }
-    v->table[j % v->cap] = &v->entries[i];
+    while (place (v, seek (v, v->hash[i]), v->hash[i], (uint32_t) i + 1) != 0)
+      if (grow (v) != 0)
+        return -1;
   }
   return 0;
 }
 
-struct vocab *
-vocab_open (const char *path)
+/**
+ * Appends the words of n records, which must not be part of the vocab yet.
+ */
+static int
+load (struct vocab *v, const struct vocab_entry *e, size_t n)
 {
-  struct vocab *v = NULL;
-  struct file *f = NULL;
+  size_t l;
+  size_t i;
 
-  f = file_open (path);
-  if (f == NULL)
-    return NULL;
+  for (i = 0; i < n; i++, v->len++) {
+    l = strnlen (e[i].word, MAX_WORD_LENGTH);
+    if (l == MAX_WORD_LENGTH)
+      return -1;
+    if (store (v, e[i].word, l, &v->offset[v->len]) != 0)
+      return -1;
+    v->hash[v->len] = e[i].hash;
+    v->count[v->len] = e[i].count;
+    v->code[v->len] = e[i].code;
+    memcpy (v->point + v->len * MAX_CODE_LENGTH, e[i].point, sizeof (e[i].point));
+  }
+  return 0;
+}
+
+/**
+ * Builds the frozen table: a copy of the table whose slots hold the offset
+ * of a key instead of the index of a word. The keys are the words again,
+ * each one behind its index, so a lookup goes from the slot straight to the
+ * word it compares and finds the index next to it. Vocabs whose keys don't
+ * fit 32 bit offsets go without.
+ */
+static int
+freeze (struct vocab *v)
+{
+  struct vocab_slot *table;
+  uint32_t *off;
+  uint32_t i;
+  size_t len;
+  size_t n;
+  char *keys;
+
+  if (v->len == 0)
+    return 0;
+  if (v->words.len + (v->len + 1) * sizeof (uint32_t) >= UINT32_MAX)
+    return 0;
+  table = mem_alloc (v->cap + TABLE_TAIL, sizeof (struct vocab_slot));
+  keys = mem_alloc (v->words.len + (v->len + 1) * sizeof (uint32_t), 1);
+  off = mem_alloc (v->len, sizeof (uint32_t));
+  if ((table == NULL) || (keys == NULL) || (off == NULL)) {
+    mem_free (table);
+    mem_free (keys);
+    mem_free (off);
+    return -1;
+  }
+  /* Offset 0 stays unused, it marks empty slots. */
+  len = sizeof (uint32_t);
+  for (i = 0; i < v->len; i++) {
+    memcpy (keys + len, &i, sizeof (uint32_t));
+    len += sizeof (uint32_t);
+    n = strlen (vocab_word (v, i)) + 1;
+    memcpy (keys + len, vocab_word (v, i), n);
+    off[i] = (uint32_t) len;
+    len += n;
+  }
+  for (n = 0; n < v->cap + TABLE_TAIL; n++) {
+    if (v->table[n].index == 0)
+      continue;
+    table[n].hash = v->table[n].hash;
+    table[n].index = off[v->table[n].index - 1];
+  }
+  mem_free (off);
+  v->frozen.table = table;
+  v->frozen.keys = keys;
+  v->frozen.len = len;
+  return 0;
+}
+
+/**
+ * Reads a file of the old layout, one record per word.
+ */
+static struct vocab *
+records (struct file *f)
+{
+  struct vocab_entry *e = NULL;
+  struct vocab *v = NULL;
+  size_t len;
+  size_t n;
 
   v = mem_alloc (1, sizeof (struct vocab));
-  if (v == NULL)
+  e = mem_alloc (RECORDS, sizeof (struct vocab_entry));
+  if ((v == NULL) || (e == NULL))
     goto error;
-  v->len = f->header.data[0];
+  len = f->header.data[0];
   v->min = f->header.data[1];
-  if (vocab_alloc (v) != 0)
+  v->limit = f->header.data[2];
+  v->error = f->header.data[3];
+  v->keep = f->header.data[4];
+  if (reserve (v, len) != 0)
     goto error;
-  if (file_read (f, v->entries, v->len * sizeof (struct vocab_entry)) != 0)
+  v->code = mem_alloc (len + 1, sizeof (uint64_t));
+  v->point = mem_alloc (len + 1, MAX_CODE_LENGTH * sizeof (int32_t));
+  if ((v->code == NULL) || (v->point == NULL))
+    goto error;
+  while (v->len < len) {
+    n = min (len - v->len, RECORDS);
+    if (file_read (f, e, n * sizeof (struct vocab_entry)) != 0)
+      goto error;
+    if (load (v, e, n) != 0)
+      goto error;
+  }
+  if (vocab_alloc (v) != 0)
     goto error;
   if (vocab_build (v) != 0)
     goto error;
-  file_close (f);
+  mem_free (e);
   return v;
 error:
   if (v)
     vocab_free (v);
-  if (f)
-    file_close (f);
+  if (e)
+    mem_free (e);
+  return NULL;
+}
+
+/**
+ * Stores the offsets and sizes of the sections of v in off and size, and
+ * returns the file size. Empty sections take no room, so files without a
+ * frozen table keep their size.
+ */
+static size_t
+layout (const struct vocab *v, size_t *off, size_t *size)
+{
+  size_t end = sizeof (((struct file *) NULL)->header);
+  size_t i;
+
+  size[SECTION_HASH] = v->len * sizeof (uint32_t);
+  size[SECTION_COUNT] = v->len * sizeof (uint32_t);
+  size[SECTION_OFFSET] = v->len * sizeof (uint32_t);
+  size[SECTION_CODE] = v->len * sizeof (uint64_t);
+  size[SECTION_POINT] = v->len * MAX_CODE_LENGTH * sizeof (int32_t);
+  size[SECTION_WORDS] = v->words.len;
+  size[SECTION_TABLE] = (v->cap + TABLE_TAIL) * sizeof (struct vocab_slot);
+  size[SECTION_FROZEN] = v->frozen.len ? size[SECTION_TABLE] : 0;
+  size[SECTION_KEYS] = v->frozen.len;
+  for (i = 0; i < SECTIONS; i++) {
+    off[i] = end;
+    if (size[i] > 0)
+      off[i] = (end + SECTION_ALIGN - 1) & ~(size_t) (SECTION_ALIGN - 1);
+    end = off[i] + size[i];
+  }
+  return end;
+}
+
+/**
+ * Maps a file of the current layout. The arrays, words and table point into
+ * the read-only mapping, so opening takes no time, and processes that open
+ * the same vocab share its pages. The vocab gets copied to the heap before
+ * it changes.
+ */
+static struct vocab *
+map (struct file *f)
+{
+  size_t size[SECTIONS];
+  size_t off[SECTIONS];
+  struct vocab *v;
+  struct stat st;
+  size_t cap;
+  char *p;
+
+  v = mem_alloc (1, sizeof (struct vocab));
+  if (v == NULL)
+    return NULL;
+  v->len = f->header.data[0];
+  v->min = f->header.data[1];
+  v->limit = f->header.data[2];
+  v->error = f->header.data[3];
+  v->keep = f->header.data[4];
+  v->cap = f->header.data[6];
+  v->words.len = f->header.data[7];
+  v->frozen.len = f->header.data[8];
+  if (v->frozen.len >= UINT32_MAX)
+    goto error;
+  if ((v->cap < TABLE_MIN) || (v->cap > TABLE_MAX) || ((v->cap & (v->cap - 1)) != 0))
+    goto error;
+  if ((v->len >= UINT32_MAX) || ((float) v->len > (float) v->cap * TABLE_LOAD))
+    goto error;
+  v->map.len = layout (v, off, size);
+  if ((fstat (f->fd, &st) != 0) || ((size_t) st.st_size < v->map.len))
+    goto error;
+  p = mmap (NULL, v->map.len, PROT_READ, MAP_SHARED, f->fd, 0);
+  if (p == MAP_FAILED)
+    goto error;
+  v->map.ptr = p;
+  v->hash = (uint32_t *) (p + off[SECTION_HASH]);
+  v->count = (uint32_t *) (p + off[SECTION_COUNT]);
+  v->offset = (uint32_t *) (p + off[SECTION_OFFSET]);
+  v->code = (uint64_t *) (p + off[SECTION_CODE]);
+  v->point = (int32_t *) (p + off[SECTION_POINT]);
+  v->words.ptr = p + off[SECTION_WORDS];
+  v->table = (struct vocab_slot *) (p + off[SECTION_TABLE]);
+  if (v->frozen.len > 0) {
+    v->frozen.table = (struct vocab_slot *) (p + off[SECTION_FROZEN]);
+    v->frozen.keys = p + off[SECTION_KEYS];
+  }
+  v->size = v->len;
+  v->words.cap = v->words.len;
+  for (v->shift = 32, cap = v->cap; cap > 1; cap >>= 1)
+    v->shift--;
+  return v;
+error:
+  mem_free (v);
   return NULL;
 }
 
+struct vocab *
+vocab_open (const char *path)
+{
+  struct vocab *v;
+  struct file *f;
+
+  f = file_open (path);
+  if (f == NULL)
+    return NULL;
+  if (f->header.data[5] == VOCAB_LAYOUT)
+    v = map (f);
+  else
+    v = records (f);
+  file_close (f);
+  return v;
+}
+
+/**
+ * Shrinks and encodes the vocab and writes it in the current layout. The
+ * file gets written under a temporary name and renamed, so that processes
+ * which have the old file mapped keep their version.
+ */
 int
 vocab_save (struct vocab *v, const char *path)
 {
+  const void *ptr[SECTIONS];
+  size_t size[SECTIONS];
+  size_t off[SECTIONS];
   struct file *f = NULL;
+  char *tmp = NULL;
+  size_t pos;
+  size_t i;
 
   if (vocab_shrink (v) != 0)
     return -1;
   if (vocab_encode (v) != 0)
     return -1;
-  f = file_create (path);
-  if (f == NULL)
+  if ((v->frozen.len == 0) && (freeze (v) != 0))
     return -1;
+  if (asprintf (&tmp, "%s.tmp", path) == -1)
+    return -1;
+  f = file_create (tmp);
+  if (f == NULL)
+    goto error;
   f->header.data[0] = v->len;
   f->header.data[1] = v->min;
-  if (file_write (f, v->entries, v->len * sizeof (struct vocab_entry)) != 0)
-    goto error;
+  f->header.data[2] = v->limit;
+  f->header.data[3] = v->error;
+  f->header.data[4] = v->keep;
+  f->header.data[5] = VOCAB_LAYOUT;
+  f->header.data[6] = v->cap;
+  f->header.data[7] = v->words.len;
+  f->header.data[8] = v->frozen.len;
+
+  ptr[SECTION_HASH] = v->hash;
+  ptr[SECTION_COUNT] = v->count;
+  ptr[SECTION_OFFSET] = v->offset;
+  ptr[SECTION_CODE] = v->code;
+  ptr[SECTION_POINT] = v->point;
+  ptr[SECTION_WORDS] = v->words.ptr;
+  ptr[SECTION_TABLE] = v->table;
+  ptr[SECTION_FROZEN] = v->frozen.table;
+  ptr[SECTION_KEYS] = v->frozen.keys;
+  layout (v, off, size);
+  pos = sizeof (f->header);
+  for (i = 0; i < SECTIONS; i++) {
+    if (file_skip (f, (off_t) (off[i] - pos)) != 0)
+      goto error;
+    if ((size[i] > 0) && (file_write (f, ptr[i], size[i]) != 0))
+      goto error;
+    pos = off[i] + size[i];
+  }
   file_close (f);
+  f = NULL;
+  if (rename (tmp, path) != 0)
+    goto error;
+  free (tmp);
   return 0;
 error:
   if (f)
     file_close (f);
+  unlink (tmp);
+  free (tmp);
   return -1;
 }
 
-static int
-parse_sentence (struct vocab *v, char *s)
-{
-  char *w;
-  while (w = strtok_r (s, " ", &s), w)
-    if (vocab_add (v, w) != 0)
-      return -1;
-  return 0;
-}
-
 int
 vocab_parse (struct vocab *v, const char *path)
 {
   struct scanner *s;
-  char b[8192] = { 0 };
-  int r = 0;
+  int r;
 
-  s = scanner_open (path);
+  s = scanner_open (path, NULL);
   if (s == NULL)
     return -1;
-  while (scanner_readline (s, b, sizeof (b)) >= 0) {
-    r = parse_sentence (v, b);
-    if (r != 0)
-      break;
-  }
+  r = vocab_scan (v, s);
   scanner_free (s);
   return r;
 }
 
-static inline float
-load_factor (const struct vocab *v)
+/**
+ * Adds the words of the scanner s. Fails if the scanner does.
+ */
+int
+vocab_scan (struct vocab *v, struct scanner *s)
 {
-  return (float) v->len / (float) v->cap;
+  const char *w;
+  size_t n;
+  int r;
+
+  while (r = scanner_next_token (s, &w, &n), r >= 0) {
+    if (r == 0)
+      if (vocab_addn (v, w, n) != 0)
+        break;
+  }
+  return -(r != -1);
 }
 
-static int
-cmp (const void *a, const void *b)
+struct rank {
+  uint32_t count;
+  uint32_t index;
+};
+
+/**
+ * Returns the k-th highest count of the n ranks, k starting at 1, and the
+ * number of ranks with that count that are among the k highest in tie. The
+ * count gets picked byte by byte from the top, every pass only looks at the
+ * ranks that match the bytes picked so far.
+ */
+static uint32_t
+select_count (const struct rank *r, size_t n, size_t k, size_t *tie)
 {
-  const struct vocab_entry *x = (const struct vocab_entry *) a;
-  const struct vocab_entry *y = (const struct vocab_entry *) b;
+  size_t hist[256];
+  uint32_t p = 0;
+  uint32_t m = 0;
+  int shift;
+  int d;
+  size_t i;
 
-  /**
-   * Sorting needs to happen in reversed order (from highest to lowest), so that the
-   * lowest entries reside at the end of the array and can be stripped off by
-   * decrementing length.
-   */
-  return (int) y->count - (int) x->count;
+  for (shift = 24; shift >= 0; shift -= 8) {
+    memset (hist, 0, sizeof (hist));
+    for (i = 0; i < n; i++)
+      if ((r[i].count & m) == p)
+        hist[(r[i].count >> shift) & 255]++;
+    for (d = 255; hist[d] < k; d--)
+      k -= hist[d];
+    p |= (uint32_t) d << shift;
+    m |= (uint32_t) 255 << shift;
+  }
+  *tie = k;
+  return p;
 }
 
+/**
+ * Sorts the n ranks at *r from the highest to the lowest count with an LSD
+ * radix sort, tmp has room for n ranks too. Every pass is stable, so equal
+ * counts keep their order, and bytes that all counts share get skipped. The
+ * sorted ranks end up in either array, *r points to it afterwards.
+ */
+static void
+sort_ranks (struct rank **r, struct rank *tmp, size_t n)
+{
+  struct rank *src = *r;
+  size_t hist[256];
+  size_t sum;
+  size_t c;
+  size_t i;
+  int shift;
+  int d;
+
+  for (shift = 0; shift < 32; shift += 8) {
+    memset (hist, 0, sizeof (hist));
+    for (i = 0; i < n; i++)
+      hist[255 - ((src[i].count >> shift) & 255)]++;
+    if (hist[255 - ((src[0].count >> shift) & 255)] == n)
+      continue;
+    for (d = 0, sum = 0; d < 256; d++) {
+      c = hist[d];
+      hist[d] = sum;
+      sum += c;
+    }
+    for (i = 0; i < n; i++)
+      tmp[hist[255 - ((src[i].count >> shift) & 255)]++] = src[i];
+    swap (src, tmp);
+  }
+  *r = src;
+}
+
+/**
+ * Sorts the words by count and drops the ones below the minimum count, as
+ * well as the ones past the maximum number of words. Equal counts keep their
+ * order. Only the kept words get sorted, and they get copied into a new
+ * arena, in their new order.
+ */
 int
 vocab_shrink (struct vocab *v)
 {
-  qsort (v->entries, v->len, sizeof (struct vocab_entry), cmp);
-  while (v->len > 0) {
-    if (v->entries[v->len - 1].count >= (uint32_t) v->min)
-      break;
-    v->len--;
+  struct vocab w = { .size = 0 };
+  struct rank *buf;
+  struct rank *r;
+  uint32_t c;
+  size_t tie;
+  size_t n;
+  size_t i;
+
+  if (thaw (v) != 0)
+    return -1;
+  buf = mem_alloc (v->len * 2 + 1, sizeof (struct rank));
+  if (buf == NULL)
+    return -1;
+  r = buf;
+  for (i = 0, n = 0; i < v->len; i++)
+    if (v->count[i] >= (uint32_t) v->min)
+      r[n++] = (struct rank) { v->count[i], (uint32_t) i };
+  if ((v->keep > 0) && (n > v->keep)) {
+    c = select_count (r, n, v->keep, &tie);
+    for (i = 0, n = 0; i < v->len; i++) {
+      if ((v->count[i] < c) || ((v->count[i] == c) && (tie == 0)))
+        continue;
+      if (v->count[i] == c)
+        tie--;
+      r[n++] = (struct rank) { v->count[i], (uint32_t) i };
+    }
+  }
+  if (n > 0)
+    sort_ranks (&r, buf + v->len, n);
+
+  if (reserve (&w, n) != 0)
+    goto error;
+  for (i = 0; i < n; i++) {
+    if (store (&w, vocab_word (v, r[i].index), strlen (vocab_word (v, r[i].index)), &w.offset[i]) != 0)
+      goto error;
+    w.hash[i] = v->hash[r[i].index];
+    w.count[i] = v->count[r[i].index];
   }
+  mem_free (buf);
+  drop_codes (v);
+  swap (v->hash, w.hash);
+  swap (v->count, w.count);
+  swap (v->offset, w.offset);
+  swap (v->words, w.words);
+  v->size = w.size;
+  v->len = n;
+  mem_free (w.hash);
+  mem_free (w.count);
+  mem_free (w.offset);
+  mem_free (w.words.ptr);
+  if (vocab_alloc (v) != 0)
+    return -1;
   if (vocab_build (v) != 0)
     return -1;
   return 0;
+error:
+  mem_free (buf);
+  mem_free (w.hash);
+  mem_free (w.count);
+  mem_free (w.offset);
+  mem_free (w.words.ptr);
+  return -1;
 }
 
+/**
+ * Returns the slot of the word w of length n with hash h, or the slot where
+ * it goes if it's missing. Only words with the same hash get compared.
+ */
 static inline size_t
-find (struct vocab *v, uint32_t h, const char *w)
+find (const struct vocab *v, uint32_t h, const char *w, size_t n)
 {
-  struct vocab_entry *entry;
-  size_t i;
+  const struct vocab_slot *t = v->table;
+  const char *x;
+  size_t i = h >> v->shift;
 
-  i = h % v->cap;
-  for (;;) {
-    entry = v->table[i];
-    if ((entry == NULL)
-        || ((entry->hash == h) && (strcmp (entry->word, w) == 0)))
+  while ((t[i].index != 0) && (t[i].hash < h))
+    i++;
+  for (; (t[i].index != 0) && (t[i].hash == h); i++) {
+    x = vocab_word (v, t[i].index - 1);
+    if ((strncmp (x, w, n) == 0) && (x[n] == '\0'))
       break;
-    i = (i + 1) % v->cap;
   }
   return i;
 }
 
+/**
+ * Finds the word w of length n with hash h in the frozen table.
+ */
+static inline int
+lookup (const struct vocab *v, uint32_t h, const char *w, size_t n, size_t *p)
+{
+  const struct vocab_slot *t = v->frozen.table;
+  const char *x;
+  uint32_t r;
+  size_t i = h >> v->shift;
+
+  while ((t[i].index != 0) && (t[i].hash < h))
+    i++;
+  for (; (t[i].index != 0) && (t[i].hash == h); i++) {
+    x = v->frozen.keys + t[i].index;
+    if ((strncmp (x, w, n) == 0) && (x[n] == '\0')) {
+      memcpy (&r, x - sizeof (uint32_t), sizeof (uint32_t));
+      *p = r;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static inline bool
+found (const struct vocab *v, size_t i, uint32_t h)
+{
+  return (v->table[i].index != 0) && (v->table[i].hash == h);
+}
+
 int
 vocab_add (struct vocab *v, const char *w)
 {
-  struct vocab_entry entry;
+  return vocab_addn (v, w, strlen (w));
+}
 
-  uint32_t h = hashstr (w);
-  size_t i = find (v, h, w);
+/**
+ * Appends the word of length n at w with hash h, which must not be part of
+ * the vocab yet.
+ */
+static int
+append (struct vocab *v, uint32_t h, const char *w, size_t n, uint32_t count)
+{
+  if ((float) (v->len + 1) > (float) v->cap * TABLE_LOAD)
+    if (grow (v) != 0)
+      return -1;
+  if (reserve (v, v->len + 1) != 0)
+    return -1;
+  while (place (v, seek (v, h), h, (uint32_t) v->len + 1) != 0)
+    if (grow (v) != 0)
+      return -1;
+  if (store (v, w, n, &v->offset[v->len]) != 0)
+    return -1;
+  drop_codes (v);
+  drop_frozen (v);
+  v->hash[v->len] = h;
+  v->count[v->len] = count;
+  v->len++;
+  return 0;
+}
+
+static int
+insert (struct vocab *v, uint32_t h, const char *w, size_t n, uint32_t count)
+{
+  size_t i = find (v, h, w, n);
 
-  if (v->table[i]) {
-    v->table[i]->count++;
+  if (found (v, i, h)) {
+    v->count[v->table[i].index - 1] += count;
     return 0;
   }
+  return append (v, h, w, n, count);
+}
 
-  if (load_factor (v) > 0.7f) {
-    v->cap <<= 2;
-    if (vocab_alloc (v) != 0)
+/**
+ * Drops the words with the lowest counts until at most PRUNE_KEEP of the
+ * limit remain, like ReduceVocab of word2vec. The kept words stay in order,
+ * so their strings only move towards the front of the arena. Every pruned
+ * word had a count of at most the threshold, which adds to the error.
+ *
+ * If too many words have counts past the histogram, the threshold gets
+ * selected among them, so that the vocab always ends up within the limit.
+ */
+static int
+prune (struct vocab *v)
+{
+  size_t hist[PRUNE_COUNTS] = { 0 };
+  const size_t cap = (size_t) ((float) v->limit * PRUNE_KEEP);
+  size_t keep = v->len;
+  size_t len = 0;
+  size_t off = 0;
+  struct rank *r;
+  size_t tie;
+  size_t l;
+  size_t i;
+  uint32_t t;
+
+  if ((v->limit == 0) || (v->len <= v->limit))
+    return 0;
+  for (i = 0; i < v->len; i++)
+    hist[min (v->count[i], PRUNE_COUNTS - 1)]++;
+  /* keep counts the words above t. The last bucket holds all higher counts. */
+  keep -= hist[0];
+  for (t = 0; (t < PRUNE_COUNTS - 2) && (keep > cap);)
+    keep -= hist[++t];
+  if (keep > cap) {
+    r = mem_alloc (keep, sizeof (struct rank));
+    if (r == NULL)
       return -1;
-    if (vocab_build (v) != 0)
+    for (i = 0, l = 0; i < v->len; i++)
+      if (v->count[i] > t)
+        r[l++] = (struct rank) { v->count[i], (uint32_t) i };
+    t = select_count (r, l, cap + 1, &tie);
+    mem_free (r);
+  }
+
+  for (i = 0; i < v->len; i++) {
+    if (v->count[i] <= t)
+      continue;
+    l = strlen (vocab_word (v, i)) + 1;
+    memmove (v->words.ptr + off, vocab_word (v, i), l);
+    v->hash[len] = v->hash[i];
+    v->count[len] = v->count[i];
+    v->offset[len] = (uint32_t) off;
+    off += l;
+    len++;
+  }
+  debug ("pruned %zu words with counts up to %u", v->len - len, t);
+  drop_codes (v);
+  v->words.len = off;
+  v->len = len;
+  v->error += t;
+  return vocab_build (v);
+}
+
+/**
+ * Adds the word of length n at w. Words that don't fit into an entry are
+ * ignored.
+ */
+int
+vocab_addn (struct vocab *v, const char *w, size_t n)
+{
+  if (n >= MAX_WORD_LENGTH)
+    return 0;
+  if (thaw (v) != 0)
+    return -1;
+  if (insert (v, hashptr (w, n), w, n, 1) != 0)
+    return -1;
+  return prune (v);
+}
+
+/**
+ * Adds the words and counts of src to dst. The error bounds add up, and dst
+ * only gets pruned once all words are in.
+ */
+int
+vocab_merge (struct vocab *dst, const struct vocab *src)
+{
+  const char *w;
+  size_t i;
+
+  if (thaw (dst) != 0)
+    return -1;
+  for (i = 0; i < src->len; i++) {
+    w = vocab_word (src, i);
+    if (insert (dst, src->hash[i], w, strlen (w), src->count[i]) != 0)
       return -1;
-    i = find (v, h, w);
   }
+  dst->error += src->error;
+  return prune (dst);
+}
+
+/**
+ * A parallel merge splits the words of all vocabs into partitions by hash.
+ * Every partition gets merged by its own thread in a private table, which
+ * adds the counts of words that dst already has right to dst. The counts of
+ * new words get summed up at their first occurrence in the sources.
+ */
+struct merge {
+  struct vocab *dst;
+  struct vocab **src;
+  size_t n;
+  size_t parts;
+  size_t *base;
+  uint32_t *total;
+  bool *first;
+};
 
-  entry = (struct vocab_entry) {
-    .hash = h,
-    .count = 1,
-  };
-  strncpy (entry.word, w, MAX_WORD_LENGTH - 1);
+struct part {
+  pthread_t thread;
+  struct merge *m;
+  size_t id;
+  int r;
+};
 
-  v->entries[v->len] = entry;
-  v->table[i] = &v->entries[v->len];
-  v->len++;
-  return 0;
+/**
+ * A slot of a partition table, src is 0 for empty slots, 1 for dst and k + 2
+ * for the source k.
+ */
+struct merge_slot {
+  uint32_t hash;
+  uint32_t src;
+  uint32_t index;
+};
+
+static inline const struct vocab *
+source (const struct merge *m, size_t k)
+{
+  return (k == 0) ? m->dst : m->src[k - 1];
+}
+
+static void *
+merge_part (void *arg)
+{
+  struct part *p = arg;
+  const struct merge *m = p->m;
+  const struct vocab *v;
+  struct merge_slot *t;
+  const char *w;
+  unsigned int bits = 6;
+  size_t mask;
+  size_t len = 0;
+  size_t i;
+  size_t j;
+  size_t k;
+  uint32_t h;
+
+  for (k = 0; k <= m->n; k++) {
+    v = source (m, k);
+    for (i = 0; i < v->len; i++)
+      len += (v->hash[i] % m->parts == p->id);
+  }
+  while (((size_t) 1 << bits) < len * 2)
+    bits++;
+  mask = ((size_t) 1 << bits) - 1;
+  t = mem_alloc (mask + 1, sizeof (struct merge_slot));
+  if (t == NULL) {
+    p->r = -1;
+    return NULL;
+  }
+
+  for (k = 0; k <= m->n; k++) {
+    v = source (m, k);
+    for (i = 0; i < v->len; i++) {
+      h = v->hash[i];
+      if (h % m->parts != p->id)
+        continue;
+      w = vocab_word (v, i);
+      for (j = (h * 2654435769u) >> (32 - bits); t[j].src; j = (j + 1) & mask)
+        if ((t[j].hash == h) && (strcmp (vocab_word (source (m, t[j].src - 1), t[j].index), w) == 0))
+          break;
+      if (t[j].src == 0) {
+        t[j] = (struct merge_slot) { h, (uint32_t) k + 1, (uint32_t) i };
+        if (k > 0) {
+          m->first[m->base[k - 1] + i] = true;
+          m->total[m->base[k - 1] + i] = v->count[i];
+        }
+      }
+      else if (t[j].src == 1) {
+        m->dst->count[t[j].index] += v->count[i];
+      }
+      else {
+        m->total[m->base[t[j].src - 2] + t[j].index] += v->count[i];
+      }
+    }
+  }
+  mem_free (t);
+  return NULL;
+}
+
+/**
+ * Adds the words and counts of the n vocabs at src to dst, using up to jobs
+ * threads. Without a limit, the result is the same as merging the sources
+ * one by one with vocab_merge: new words get appended in the order of their
+ * first occurrence.
+ */
+int
+vocab_mergeall (struct vocab *dst, struct vocab **src, size_t n, size_t jobs)
+{
+  struct merge m = { dst, src, n, max (jobs, 1), NULL, NULL, NULL };
+  struct part *p = NULL;
+  const char *w;
+  size_t len = 0;
+  size_t i;
+  size_t k;
+  int r = -1;
+
+  if (thaw (dst) != 0)
+    return -1;
+  m.base = mem_alloc (n + 1, sizeof (size_t));
+  if (m.base == NULL)
+    return -1;
+  for (k = 0; k < n; k++) {
+    m.base[k] = len;
+    len += src[k]->len;
+  }
+  m.total = mem_alloc (len + 1, sizeof (uint32_t));
+  m.first = mem_alloc (len + 1, sizeof (bool));
+  p = mem_alloc (m.parts, sizeof (struct part));
+  if ((m.total == NULL) || (m.first == NULL) || (p == NULL))
+    goto cleanup;
+
+  for (i = 0; i < m.parts; i++) {
+    p[i].m = &m;
+    p[i].id = i;
+  }
+  for (i = 1; i < m.parts; i++)
+    if (pthread_create (&p[i].thread, NULL, merge_part, &p[i]) != 0)
+      break;
+  merge_part (&p[0]);
+  r = p[0].r;
+  if (i < m.parts)
+    r = -1;
+  while (--i > 0) {
+    pthread_join (p[i].thread, NULL);
+    r |= p[i].r;
+  }
+  if (r != 0)
+    goto cleanup;
+
+  for (k = 0; k < n; k++) {
+    for (i = 0; i < src[k]->len; i++) {
+      if (!m.first[m.base[k] + i])
+        continue;
+      w = vocab_word (src[k], i);
+      r = append (dst, src[k]->hash[i], w, strlen (w), m.total[m.base[k] + i]);
+      if (r != 0)
+        goto cleanup;
+    }
+    dst->error += src[k]->error;
+  }
+  r = prune (dst);
+cleanup:
+  mem_free (p);
+  mem_free (m.first);
+  mem_free (m.total);
+  mem_free (m.base);
+  return r;
 }
 
 int
 vocab_find (struct vocab *v, const char *w, size_t *p)
 {
-  size_t i = find (v, hashstr (w), w);
+  return vocab_findn (v, w, strlen (w), p);
+}
+
+int
+vocab_findn (struct vocab *v, const char *w, size_t n, size_t *p)
+{
+  uint32_t h;
+  size_t i;
 
-  if (v->table[i])
-    *p = (size_t) (v->table[i] - v->entries);
-  return -(v->table[i] == NULL);
+  if (n >= MAX_WORD_LENGTH)
+    return -1;
+  h = hashptr (w, n);
+  if (v->frozen.len > 0)
+    return lookup (v, h, w, n, p);
+  i = find (v, h, w, n);
+  if (!found (v, i, h))
+    return -1;
+  *p = (size_t) v->table[i].index - 1;
+  return 0;
 }
 
 int
 vocab_encode (struct vocab *v)
 {
-  struct vocab_entry *entry;
-
   int32_t point[MAX_CODE_LENGTH];
+  int32_t *p;
 
   uint32_t a, b, i;
   uint32_t m1, m2;
@@ -276,6 +1215,16 @@ vocab_encode (struct vocab *v)
   if (v->len > INT32_MAX)
     return -1;
 
+  if (thaw (v) != 0)
+    return -1;
+  drop_codes (v);
+  v->code = mem_alloc (v->len, sizeof (uint64_t));
+  v->point = mem_alloc (v->len, MAX_CODE_LENGTH * sizeof (int32_t));
+  if ((v->code == NULL) || (v->point == NULL)) {
+    drop_codes (v);
+    return -1;
+  }
+
   count = mem_alloc (v->len * 2 + 1, sizeof (uint32_t));
   binary = mem_alloc (v->len / 16 + 1, sizeof (uint32_t));
   parent = mem_alloc (v->len * 2 + 1, sizeof (uint32_t));
@@ -287,7 +1236,7 @@ vocab_encode (struct vocab *v)
     goto cleanup;
 
   for (a = 0; a < v->len; a++)
-    count[a] = v->entries[a].count;
+    count[a] = v->count[a];
 
   for (; a < v->len * 2; a++)
     count[a] = 0x10000000;
@@ -329,36 +1278,46 @@ vocab_encode (struct vocab *v)
     binary[m2 / 32] |= 1u << (m2 % 32);
   }
 
-  entry = v->entries;
   for (a = 0; a < v->len; a++) {
-    entry->code = 1ull;
+    p = v->point + (size_t) a * MAX_CODE_LENGTH;
+    v->code[a] = 1ull;
     for (b = a, i = 0; b != (v->len * 2 - 2); b = parent[b], i++) {
-      entry->code <<= 1;
-      entry->code |= (binary[b / 32] >> (b % 32)) & 1ull;
+      v->code[a] <<= 1;
+      v->code[a] |= (binary[b / 32] >> (b % 32)) & 1ull;
       point[i] = (int32_t) b;
     }
-    entry->point[0] = (int32_t) v->len - 2;
+    p[0] = (int32_t) v->len - 2;
     for (b = 0; b < i; b++)
-      entry->point[i - b] = point[b] - (int32_t) v->len;
-    entry++;
+      p[i - b] = point[b] - (int32_t) v->len;
   }
 
   for (a = 0; a < v->len; a++) {
+    p = v->point + (size_t) a * MAX_CODE_LENGTH;
     for (b = 0; b < MAX_CODE_LENGTH; b++) {
-      if ((v->entries[a].code >> b) <= 1)
-        v->entries[a].point[b] = 0;
+      if ((v->code[a] >> b) <= 1)
+        p[b] = 0;
     }
   }
 
 cleanup:
+  if (r)
+    drop_codes (v);
   mem_free (count);
   mem_free (binary);
   mem_free (parent);
   return -r;
 }
 
+/**
+ * Returns a hash of the words and their counts in order. The hashes stand in
+ * for the words.
+ */
 uint32_t
 vocab_id (struct vocab *v)
 {
-  return hashptr (v->entries, v->len * sizeof (struct vocab_entry));
+  uint32_t h[2];
+
+  h[0] = hashptr (v->hash, v->len * sizeof (uint32_t));
+  h[1] = hashptr (v->count, v->len * sizeof (uint32_t));
+  return hashptr (h, sizeof (h));
 }
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "scanner.h"
+
 #define MAX_CODE_LENGTH 40
 #define MAX_WORD_LENGTH 80
 
@@ -19,6 +21,9 @@
 #error "word length requires new serialize functions"
 #endif
 
+/**
+ * The record of a word in vocab files.
+ */
 struct vocab_entry {
   uint32_t hash;
   uint32_t count;
@@ -27,12 +32,72 @@ struct vocab_entry {
   char word[MAX_WORD_LENGTH];
 };
 
+/**
+ * A slot of the hash table: the hash of a word and its index plus 1, so 0
+ * marks empty slots.
+ */
+struct vocab_slot {
+  uint32_t hash;
+  uint32_t index;
+};
+
+/**
+ * Words are stored null-terminated in one string arena and referred to by
+ * their offset. Counting only touches the table and the hash, count and
+ * offset arrays, which take a few bytes per word. The Huffman codes and
+ * points are built by vocab_encode and dropped when the words change.
+ *
+ * The table is a Robin Hood hash table that keeps its slots sorted by hash.
+ * The top bits of a hash select its home slot, and probes only compare words
+ * whose hash matches. The table doesn't wrap around, the last homes spill
+ * into a few extra slots past cap.
+ *
+ * Shrinking drops the words below min, and keeps at most keep words if it
+ * isn't 0.
+ *
+ * Vocabs opened from a file are mapped read-only until they change, see
+ * vocab_open.
+ *
+ * Saving also freezes the table for lookups. The frozen table has the same
+ * slots, but they point straight at a copy of the word that is stored next
+ * to its index, which saves the trip through the offset array. It gets
+ * dropped when the words change.
+ *
+ * With a limit, counting never keeps more than limit words: the words with
+ * the lowest counts get pruned whenever the vocab grows past it. The counts
+ * are then approximate, a word's true count lies between its count and
+ * count + error, and words missing from the vocab occurred at most error
+ * times.
+ */
 struct vocab {
   size_t min;
+  size_t keep;
+  size_t limit;
+  size_t error;
   size_t cap;
   size_t len;
-  struct vocab_entry **table;
-  struct vocab_entry *entries;
+  size_t size;
+  unsigned int shift;
+  struct vocab_slot *table;
+  uint32_t *hash;
+  uint32_t *count;
+  uint32_t *offset;
+  struct {
+    size_t len;
+    size_t cap;
+    char *ptr;
+  } words;
+  uint64_t *code;
+  int32_t *point;
+  struct {
+    void *ptr;
+    size_t len;
+  } map;
+  struct {
+    struct vocab_slot *table;
+    char *keys;
+    size_t len;
+  } frozen;
 };
 
 struct vocab *vocab_new (void);
@@ -42,10 +107,27 @@ int vocab_save (struct vocab *v, const char *path);
 int vocab_alloc (struct vocab *v);
 int vocab_build (struct vocab *v);
 int vocab_parse (struct vocab *v, const char *path);
+int vocab_scan (struct vocab *v, struct scanner *s);
+int vocab_merge (struct vocab *dst, const struct vocab *src);
+int vocab_mergeall (struct vocab *dst, struct vocab **src, size_t n, size_t jobs);
 int vocab_add (struct vocab *v, const char *w);
+int vocab_addn (struct vocab *v, const char *w, size_t n);
 int vocab_find (struct vocab *v, const char *w, size_t *p);
+int vocab_findn (struct vocab *v, const char *w, size_t n, size_t *p);
 int vocab_shrink (struct vocab *v);
 int vocab_encode (struct vocab *v);
 uint32_t vocab_id (struct vocab *v);
 
+static inline const char *
+vocab_word (const struct vocab *v, size_t i)
+{
+  return v->words.ptr + v->offset[i];
+}
+
+static inline const int32_t *
+vocab_point (const struct vocab *v, size_t i)
+{
+  return v->point + i * MAX_CODE_LENGTH;
+}
+
 #endif
@@ -0,0 +1,91 @@
+#include "../src/bundle.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#define TEST_PATH "/tmp/bundle"
+#define LAYER 8
+
+/**
+ * Words and vectors of the model before the vocab changed.
+ */
+static char words[16][16];
+static float rows[16][LAYER];
+static size_t len;
+
+static void
+create (void)
+{
+  struct vocab *v;
+  struct model *m;
+  size_t i;
+
+  mkdir (TEST_PATH, 0755);
+  v = vocab_new ();
+  assert (v != NULL);
+  v->min = 0;
+  assert (vocab_parse (v, "tests/testdata/vocab.txt") == 0);
+  assert (vocab_save (v, TEST_PATH "/vocab") == 0);
+  m = model_new (v, MODEL_NN);
+  assert (m != NULL);
+  m->size.layer = LAYER;
+  m->size.vector = LAYER;
+  assert (model_save (m, TEST_PATH "/model") == 0);
+  assert (model_generate (m) == 0);
+
+  len = v->len;
+  assert (len <= 16);
+  for (i = 0; i < len; i++) {
+    strcpy (words[i], vocab_word (v, i));
+    memcpy (rows[i], m->embeddings + i * LAYER, sizeof (rows[i]));
+  }
+  model_free (m);
+  vocab_free (v);
+}
+
+/**
+ * Adds a word that ranks first and drops the three least frequent words.
+ * The vectors of the other words must move with them.
+ */
+static void
+test_remap (void)
+{
+  struct bundle *b;
+  size_t i;
+  size_t j;
+  size_t x;
+
+  b = bundle_open (TEST_PATH);
+  assert ((b != NULL) && (b->vocab != NULL) && (b->model != NULL));
+  for (i = 0; i < 100; i++)
+    assert (vocab_add (b->vocab, "zebra") == 0);
+  b->vocab->keep = len - 2;
+  assert (bundle_remap (b) == 0);
+  bundle_free (b);
+
+  b = bundle_open (TEST_PATH);
+  assert ((b != NULL) && (b->vocab != NULL) && (b->model != NULL));
+  assert (b->vocab->len == len - 2);
+  assert (b->model->size.vocab == len - 2);
+  assert (strcmp (vocab_word (b->vocab, 0), "zebra") == 0);
+  assert (model_generate (b->model) == 0);
+  for (i = 0, j = 0; i < len; i++) {
+    if (vocab_find (b->vocab, words[i], &x) != 0)
+      continue;
+    assert (memcmp (b->model->embeddings + x * LAYER, rows[i], sizeof (rows[i])) == 0);
+    j++;
+  }
+  assert (j == len - 3);
+  bundle_free (b);
+}
+
+int
+main (void)
+{
+  create ();
+  test_remap ();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include "../src/config.h"
+#include "../src/classify.h"
+#include "../src/scanner.h"
+#include "../src/string.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#define TEST_PATH "/tmp/classify.txt"
+
+static uint64_t state = 88172645463325252ull;
+
+static unsigned char
+next (void)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return (unsigned char) state;
+}
+
+/**
+ * Mostly letters, with some spaces, control characters, DEL and bytes
+ * above 127, so that every class shows up in every block.
+ */
+static unsigned char
+byte (void)
+{
+  const unsigned char c = next ();
+
+  switch (c & 7) {
+    case 0:
+      return next ();
+    case 1:
+      return ' ';
+    default:
+      return (unsigned char) ('a' + c % 26);
+  }
+}
+
+static void
+check (uint64_t (*fn) (const unsigned char *), const unsigned char *p)
+{
+  assert (fn (p) == classify_scalar (p, CLASSIFY_BLOCK));
+}
+
+/**
+ * Compares the vector versions to the scalar one at every alignment, and
+ * the scalar one on tails to itself on whole blocks.
+ */
+static void
+test_blocks (void)
+{
+  unsigned char b[CLASSIFY_BLOCK * 3];
+  uint64_t m;
+  size_t off;
+  size_t n;
+  int r;
+
+  for (r = 0; r < 1000; r++) {
+    for (n = 0; n < sizeof (b); n++)
+      b[n] = (r & 1) ? next () : byte ();
+    for (off = 0; off < CLASSIFY_BLOCK; off++) {
+      check (classify, b + off);
+#if defined(__SSE2__)
+      check (classify_sse2, b + off);
+#endif
+#if defined(HAVE_AVX2)
+      if (__builtin_cpu_supports ("avx2"))
+        check (classify_avx2, b + off);
+#endif
+      m = classify_scalar (b + off, CLASSIFY_BLOCK);
+      for (n = 0; n < CLASSIFY_BLOCK; n++)
+        assert (classify_scalar (b + off, n) == (m & ((1ull << n) - 1)));
+    }
+  }
+}
+
+/**
+ * Drops non-ASCII bytes and collapses whitespace into single spaces between
+ * words, byte by byte.
+ */
+static size_t
+reference (char *b, const unsigned char *p, size_t n)
+{
+  size_t i = 0;
+  size_t k;
+  int space = 0;
+
+  for (k = 0; k < n; k++) {
+    if (isunicode (p[k]))
+      continue;
+    if (isspace (p[k])) {
+      space = (i > 0);
+      continue;
+    }
+    if (space)
+      b[i++] = ' ';
+    space = 0;
+    b[i++] = (char) p[k];
+  }
+  b[i] = '\0';
+  return i;
+}
+
+/**
+ * Lines of every length up to a few blocks, which start at every alignment
+ * of the mapping, must come out of the scanner like the reference cleans
+ * them.
+ */
+static void
+test_lines (void)
+{
+  static unsigned char lines[256][CLASSIFY_BLOCK * 4];
+  static size_t len[256];
+  char a[CLASSIFY_BLOCK * 4 + 1];
+  char b[CLASSIFY_BLOCK * 4 + 1];
+  struct scanner *s;
+  FILE *f;
+  size_t i;
+  size_t k;
+
+  f = fopen (TEST_PATH, "w");
+  assert (f != NULL);
+  for (i = 0; i < 256; i++) {
+    len[i] = i;
+    for (k = 0; k < len[i]; k++)
+      while (lines[i][k] = byte (), lines[i][k] == '\n');
+    fwrite (lines[i], 1, len[i], f);
+    fputc ('\n', f);
+  }
+  fclose (f);
+
+  s = scanner_open (TEST_PATH, NULL);
+  assert (s != NULL);
+  for (i = 0; i < 256; i++) {
+    if (reference (a, lines[i], len[i]) == 0)
+      continue;
+    assert (scanner_readline (s, b, sizeof (b)) == 0);
+    assert (strcmp (a, b) == 0);
+  }
+  assert (scanner_readline (s, b, sizeof (b)) != 0);
+  scanner_free (s);
+  remove (TEST_PATH);
+}
+
+int
+main (void)
+{
+  test_blocks ();
+  test_lines ();
+  return EXIT_SUCCESS;
+}
@@ -2,6 +2,8 @@
 #include "../src/corpus.h"
 
 #include <string.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 
@@ -18,6 +20,32 @@ const size_t words[] = {
   4, 1, 0, 2, 2,
 };
 
+/**
+ * Reads the corpus from stdin in blocks of n sentences, which must produce
+ * the same words as parsing it at once.
+ */
+static void
+test_blocks (struct corpus *c, size_t n, size_t total)
+{
+  struct scanner *s;
+  size_t l = 0;
+  int r;
+
+  assert (freopen ("tests/testdata/corpus.txt", "r", stdin) != NULL);
+  s = scanner_open ("-", NULL);
+  assert (s != NULL);
+  do {
+    r = corpus_read (c, s, n);
+    assert (r >= 0);
+    assert (c->sentences.len <= n);
+    assert (memcmp (c->words.ptr, words + l, c->words.len * sizeof (size_t)) == 0);
+    l += c->words.len;
+    corpus_clear (c);
+  } while (r == 0);
+  assert (l == total);
+  scanner_free (s);
+}
+
 int
 main (void)
 {
@@ -39,7 +67,11 @@ main (void)
   assert (c != NULL);
   assert (corpus_parse (c, "tests/testdata/corpus.txt") == 0);
   assert (memcmp (c->words.ptr, words, c->words.len * sizeof (size_t)) == 0);
+  i = c->words.len;
   corpus_clear (c);
+  test_blocks (c, 1, i);
+  test_blocks (c, 3, i);
+  test_blocks (c, SIZE_MAX, i);
   // Stress test to trigger a memory rebuild.
   for (i = 0; i < 2000; i++)
     assert (corpus_parse (c, "tests/testdata/corpus.txt") == 0);
@@ -0,0 +1,42 @@
+#include "../src/dedup.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define check(d,s) \
+  dedup_check (d, s, strlen (s))
+
+int
+main (void)
+{
+  struct dedup *d;
+
+  d = dedup_new (1 << 16);
+  assert (d != NULL);
+
+  assert (!check (d, ""));
+  assert (!check (d, "   "));
+  assert (d->seen.lines == 0);
+
+  assert (!check (d, "click here to subscribe"));
+  assert (check (d, "click here to subscribe"));
+  assert (check (d, "  click  here\tto subscribe "));
+  assert (!check (d, "click here to unsubscribe"));
+  assert (!check (d, "subscribe to click here"));
+  assert (d->removed.exact == 2);
+
+  /* Non-ASCII bytes don't count, like in the scanner. */
+  assert (!check (d, "caf\xc3\xa9 au lait"));
+  assert (check (d, "caf au lait"));
+
+  assert (!check (d, "the quick brown fox jumps over the lazy dog while the cat watches from the warm windowsill"));
+  assert (check (d, "the quick brown fox jumps over the lazy dog while the cat watches from the warm windowsill today"));
+  assert (!check (d, "a completely different sentence about rivers and mountains in the far north of the country"));
+  assert (d->removed.near == 1);
+  assert (d->removed.words == 4 + 4 + 3 + 18);
+  assert (d->seen.lines == 10);
+
+  dedup_free (d);
+  return EXIT_SUCCESS;
+}
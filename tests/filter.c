@@ -1,4 +1,4 @@
-#include "../src/string.h"
+#include "../src/filter.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -11,6 +11,13 @@
     assert (strcmp (filter (buf), out) == 0); \
   } while (0)
 
+#define testline(inp,out) \
+  do { \
+    char buf[1024]; \
+    size_t n = filterline (buf, inp, strlen (inp)); \
+    assert ((n == strlen (out)) && (memcmp (buf, out, n) == 0)); \
+  } while (0)
+
 int
 main (void)
 {
@@ -23,6 +30,7 @@ main (void)
   test ("test test", "test test");
   test ("-test-", "test");
   test ("test-test", "test test");
+  test ("test- test", "test test");
   test ("testing tests", "test test");
   test ("test test   \0test", "test test");
   test ("test test t#es!t", "test test test");
@@ -31,5 +39,19 @@ main (void)
   test ("testing testing testing", "test test test");
   test ("http://www.example.org/", "");
   test ("www.example.org", "wwwexampleorg");
+  test ("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "");
+  test ("AAAAAAAAAAAAAAAAaaaaaaaaaaaaaaaaaB", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab");
+  test ("Bbbbbbbbbbbbbbbbb", "");
+  test ("BbbbbbbbbbbbbbbbBbbbbbbbbbbbbbbbBbbbbbbbbbbbbbbbc", "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbc");
+  test ("Antidisestablishmentarianism", "antidisestablishmentarian");
+  test ("ANTIDISESTABLISHMENT-arianism", "antidisestablish arian");
+  test ("antidisestablish#mentarianism", "antidisestablishmentarian");
+  test ("antidisestablish-mentarianism", "antidisestablish mentarian");
+  test ("antidisestablishmentarianism-", "antidisestablishmentarian");
+  test ("antidisestablishmentarianism-aaaaaaaaaaaaaaaaaaaaa", "antidisestablishmentarian");
+  testline ("", "");
+  testline ("  the  of  ", "");
+  testline ("testing  tests\t", "test test\n");
+  testline ("te\xc3\xa4st- caf\xc3\xa9s", "test caf\n");
   return EXIT_SUCCESS;
 }
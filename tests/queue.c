@@ -0,0 +1,92 @@
+#include "../src/queue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_DIR    "/tmp/queue"
+
+static void
+touch (const char *path, const char *text)
+{
+  FILE *f;
+
+  f = fopen (path, "w");
+  assert (f != NULL);
+  fputs (text, f);
+  fclose (f);
+}
+
+/**
+ * Symbolic links back to the directory itself or to a parent get skipped,
+ * and so do links to files that were added already. A dangling link only
+ * skips itself, not the rest of the walk.
+ */
+static void
+test_symlinks (void)
+{
+  struct queue *q;
+  size_t i;
+
+  assert (system ("rm -rf " TEST_DIR) == 0);
+  assert (mkdir (TEST_DIR, 0755) == 0);
+  assert (mkdir (TEST_DIR "/a", 0755) == 0);
+  assert (mkdir (TEST_DIR "/b", 0755) == 0);
+  touch (TEST_DIR "/a/x", "hello\n");
+  touch (TEST_DIR "/b/y", "hello world\n");
+  assert (symlink ("..", TEST_DIR "/a/up") == 0);
+  assert (symlink (".", TEST_DIR "/a/self") == 0);
+  assert (symlink ("../b/y", TEST_DIR "/a/y") == 0);
+  assert (symlink ("gone", TEST_DIR "/a/dangling") == 0);
+
+  q = queue_new ();
+  assert (q != NULL);
+  assert (queue_add (q, TEST_DIR) == 0);
+  assert (q->len == 2);
+  assert (q->entries[0].size == 12);
+  assert (strcmp (q->entries[1].path, TEST_DIR "/a/x") == 0);
+  /* Adding the same files again adds nothing. */
+  assert (queue_add (q, TEST_DIR "/b") == 0);
+  assert (queue_add (q, TEST_DIR "/a/x") == 0);
+  assert (q->len == 2);
+  for (i = 0; i < q->len; i++)
+    assert (q->entries[i].end == SIZE_MAX);
+  queue_free (q);
+  assert (system ("rm -rf " TEST_DIR) == 0);
+}
+
+/**
+ * Many files must all get added once, across growing the set of seen files.
+ */
+static void
+test_many (void)
+{
+  struct queue *q;
+  char p[64];
+  size_t i;
+
+  assert (system ("rm -rf " TEST_DIR) == 0);
+  assert (mkdir (TEST_DIR, 0755) == 0);
+  for (i = 0; i < 3000; i++) {
+    snprintf (p, sizeof (p), TEST_DIR "/%zu", i);
+    touch (p, "x\n");
+  }
+  q = queue_new ();
+  assert (q != NULL);
+  assert (queue_add (q, TEST_DIR) == 0);
+  assert (queue_add (q, TEST_DIR "/17") == 0);
+  assert (q->len == 3000);
+  queue_free (q);
+  assert (system ("rm -rf " TEST_DIR) == 0);
+}
+
+int
+main (void)
+{
+  test_symlinks ();
+  test_many ();
+  return EXIT_SUCCESS;
+}
@@ -1,7 +1,12 @@
+#include "../src/config.h"
+#include "../src/filter.h"
 #include "../src/scanner.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <assert.h>
 
 const char *lines[] = {
@@ -13,24 +18,404 @@ const char *lines[] = {
 };
 
 static void
-test (const char *path)
+test_pass (struct scanner *s)
 {
-  struct scanner *s;
   char b[1024];
   int i;
 
-  s = scanner_open (path);
-  assert (s != NULL);
   i = 0;
   while (scanner_readline (s, b, sizeof (b)) == 0)
     assert ((i < 5) && (strcmp (lines[i++], b) == 0));
   assert (i == 5);
-  scanner_rewind (s);
-  i = 0;
+}
+
+static void
+test_lines (struct scanner *s)
+{
+  assert (s != NULL);
+  test_pass (s);
+  assert (scanner_rewind (s) == 0);
+  test_pass (s);
+  scanner_free (s);
+}
+
+/**
+ * Returns the read end of a pipe that a child process feeds with the content
+ * of path in small pieces.
+ */
+static int
+pipefrom (const char *path)
+{
+  char b[97];
+  ssize_t n;
+  int fd[2];
+  int in;
+
+  assert (pipe (fd) == 0);
+  if (fork () == 0) {
+    close (fd[0]);
+    in = open (path, O_RDONLY);
+    while (n = read (in, b, sizeof (b)), n > 0)
+      assert (write (fd[1], b, (size_t) n) == n);
+    _exit (0);
+  }
+  close (fd[1]);
+  return fd[0];
+}
+
+static void
+test (const char *path)
+{
+  struct scanner *s;
+
+  s = scanner_open (path, NULL);
+  assert (s != NULL);
+  assert (s->map.ptr != NULL);
+  test_lines (s);
+
+  s = scanner_new (open (path, O_RDONLY));
+  assert (s != NULL);
+  assert (s->map.ptr == NULL);
+  test_lines (s);
+
+  s = scanner_new (pipefrom (path));
+  assert (s != NULL);
+  test_pass (s);
+  scanner_free (s);
+  wait (NULL);
+}
+
+static void
+test_range (const char *path, size_t begin, size_t end, char (*all)[1024], int *i)
+{
+  struct scanner *s;
+  char b[1024];
+
+  s = scanner_open_range (path, begin, end, NULL);
+  assert (s != NULL);
   while (scanner_readline (s, b, sizeof (b)) == 0)
-    assert ((i < 5) && (strcmp (lines[i++], b) == 0));
-  assert (i == 5);
+    assert (strcmp (all[(*i)++], b) == 0);
+  scanner_free (s);
+}
+
+static void
+test_ranges (const char *path)
+{
+  struct scanner *s;
+  char all[64][1024];
+  size_t bounds[9];
+  size_t j;
+  size_t n;
+  int i;
+  int l;
+
+  s = scanner_open (path, NULL);
+  assert (s != NULL);
+  l = 0;
+  while (scanner_readline (s, all[l], sizeof (all[l])) == 0)
+    assert (++l < 64);
+  scanner_free (s);
+
+  for (n = 1; n < 9; n++) {
+    assert (scanner_split (path, n, bounds, NULL) == 0);
+    for (i = 0, j = 0; j < n; j++) {
+      assert (bounds[j] <= bounds[j + 1]);
+      test_range (path, bounds[j], bounds[j + 1], all, &i);
+    }
+    assert (i == l);
+  }
+  /* Bounds that aren't snapped to line starts. */
+  for (n = 1; n < 200; n += 7) {
+    for (i = 0, j = 0; j < 20000; j += n)
+      test_range (path, j, j + n, all, &i);
+    assert (i == l);
+  }
+}
+
+/**
+ * Compressed files and XML can only be read as a whole.
+ */
+static void
+test_unsplittable (const char *path)
+{
+  size_t bounds[3];
+
+  assert (scanner_split (path, 2, bounds, NULL) != 0);
+  assert (scanner_open_range (path, 0, 100, NULL) == NULL);
+}
+
+/**
+ * Words joined by spaces must be the lines of scanner_readline, including
+ * lines that don't fit into the line buffer.
+ */
+static void
+test_tokens (const char *path)
+{
+  static char a[65536];
+  static char b[65536];
+  struct scanner *s;
+  struct scanner *t;
+  const char *w;
+  size_t l;
+  size_t n;
+  int r;
+
+  s = scanner_open (path, NULL);
+  t = scanner_open (path, NULL);
+  assert ((s != NULL) && (t != NULL));
+  l = 0;
+  while (r = scanner_next_token (s, &w, &n), r >= 0) {
+    if (r == 0) {
+      assert ((n > 0) && (memchr (w, ' ', n) == NULL));
+      if (l > 0)
+        b[l++] = ' ';
+      memcpy (b + l, w, n);
+      l += n;
+      continue;
+    }
+    assert (l > 0);
+    b[l] = '\0';
+    assert (scanner_readline (t, a, sizeof (a)) == 0);
+    assert (strcmp (a, b) == 0);
+    l = 0;
+  }
+  assert (scanner_readline (t, a, sizeof (a)) != 0);
+  scanner_free (s);
+  scanner_free (t);
+}
+
+static void
+test_unfinished (void)
+{
+  struct scanner *s;
+  char b[1024];
+  int fd[2];
+
+  /* Freeing must not wait for a read that never completes. */
+  assert (pipe (fd) == 0);
+  assert (write (fd[1], "one\ntwo", 7) == 7);
+  s = scanner_new (fd[0]);
+  assert (s != NULL);
+  assert (scanner_readline (s, b, sizeof (b)) == 0);
+  assert (strcmp (b, "one") == 0);
+  scanner_free (s);
+  close (fd[1]);
+}
+
+/**
+ * Non-blocking pipes must wait for data instead of failing or spinning.
+ */
+static void
+test_nonblocking (void)
+{
+  struct scanner *s;
+  char b[1024];
+  int fd[2];
+
+  assert (pipe (fd) == 0);
+  assert (fcntl (fd[0], F_SETFL, O_NONBLOCK) == 0);
+  if (fork () == 0) {
+    close (fd[0]);
+    usleep (100000);
+    assert (write (fd[1], "one\n", 4) == 4);
+    usleep (100000);
+    assert (write (fd[1], "two\n", 4) == 4);
+    _exit (0);
+  }
+  close (fd[1]);
+  s = scanner_new (fd[0]);
+  assert (s != NULL);
+  assert (scanner_readline (s, b, sizeof (b)) == 0);
+  assert (strcmp (b, "one") == 0);
+  assert (scanner_readline (s, b, sizeof (b)) == 0);
+  assert (strcmp (b, "two") == 0);
+  assert (scanner_readline (s, b, sizeof (b)) == -1);
+  scanner_free (s);
+  wait (NULL);
+}
+
+/**
+ * Failing reads must not look like the end of the input.
+ */
+static void
+test_error (void)
+{
+  struct scanner *s;
+  const char *w;
+  char b[1024];
+  size_t n;
+
+  s = scanner_new (open ("tests", O_RDONLY));
+  assert (s != NULL);
+  assert (scanner_readline (s, b, sizeof (b)) == -2);
   scanner_free (s);
+  s = scanner_new (open ("tests", O_RDONLY));
+  assert (s != NULL);
+  assert (scanner_next_token (s, &w, &n) == -2);
+  scanner_free (s);
+}
+
+/**
+ * A compressed file that is cut short must fail after its last complete
+ * lines instead of ending quietly.
+ */
+static void
+test_truncated (const char *path)
+{
+  struct scanner *s;
+  char b[1 << 16];
+  ssize_t n;
+  int in;
+  int out;
+  int r;
+
+  in = open (path, O_RDONLY);
+  out = open ("/tmp/truncated", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert ((in >= 0) && (out >= 0));
+  n = read (in, b, sizeof (b));
+  assert (n > 64);
+  assert (write (out, b, (size_t) n - 16) == n - 16);
+  close (in);
+  close (out);
+
+  s = scanner_open ("/tmp/truncated", NULL);
+  assert (s != NULL);
+  assert (s->decoder != NULL);
+  while (r = scanner_readline (s, b, sizeof (b)), r == 0);
+  assert (r == -2);
+  scanner_free (s);
+  unlink ("/tmp/truncated");
+}
+
+static void
+test_compressed (const char *path)
+{
+  struct scanner *s;
+
+  s = scanner_open (path, NULL);
+  assert (s != NULL);
+  assert (s->decoder != NULL);
+  test_lines (s);
+
+  /* Pipes can't seek, so the format must be told from the read buffer. */
+  s = scanner_new (pipefrom (path));
+  assert (s != NULL);
+  assert (s->decoder != NULL);
+  test_pass (s);
+  scanner_free (s);
+  wait (NULL);
+}
+
+/**
+ * Filtering scanners must produce the words filterline writes.
+ */
+static void
+test_filtered (const char *path)
+{
+  struct scanner *s;
+  struct scanner *t;
+  const char *w;
+  const char *p;
+  char b[1 << 16];
+  size_t n;
+  size_t m;
+  size_t k;
+  int r;
+
+  s = scanner_open (path, &(struct scanner_options) { .filter = true });
+  t = scanner_open (path, NULL);
+  assert ((s != NULL) && (t != NULL));
+  while (scanner_readtext (t, &p, &n) == 0) {
+    m = filterline (b, p, n);
+    if (m == 0)
+      continue;
+    for (k = 0; k < m; k += n + 1) {
+      assert (scanner_next_token (s, &w, &n) == 0);
+      assert ((k + n < m) && (memcmp (b + k, w, n) == 0));
+      assert ((b[k + n] == ' ') || (b[k + n] == '\n'));
+    }
+    assert (scanner_next_token (s, &w, &n) == 1);
+  }
+  r = scanner_next_token (s, &w, &n);
+  assert (r == -1);
+  scanner_free (s);
+  scanner_free (t);
+}
+
+static void
+test_adapter (const char *path, const struct scanner_options *o, const char **expect, int n)
+{
+  struct scanner *s;
+  char b[1024];
+  int r;
+  int i;
+
+  s = scanner_open (path, o);
+  assert (s != NULL);
+  for (r = 0; r < 2; r++) {
+    i = 0;
+    while (scanner_readline (s, b, sizeof (b)) == 0)
+      assert ((i < n) && (strcmp (expect[i++], b) == 0));
+    assert (i == n);
+    assert (scanner_rewind (s) == 0);
+  }
+  scanner_free (s);
+}
+
+static void
+test_adapters (void)
+{
+  const char *jsonl[] = {
+    "Hello World",
+    "first line",
+    "second \"quoted\" line end!",
+    "caf and ABC",
+  };
+  const char *xml[] = {
+    "Some text & more",
+    "spanning lines <b>bold</b> AB",
+    "end",
+    "Another",
+    "page",
+  };
+  const char *tsv[] = {
+    "one two",
+    "three",
+    "four",
+    "five six",
+  };
+  struct adapter a;
+  struct scanner_options o = { .format = &a };
+
+  test_adapter ("tests/testdata/adapter.jsonl", NULL, jsonl, 4);
+  test_adapter ("tests/testdata/adapter.xml", NULL, xml, 5);
+  assert (adapter_parse (&a, "tsv:0") != 0);
+  assert (adapter_parse (&a, "csv") != 0);
+  assert (adapter_parse (&a, "tsv:2") == 0);
+  test_adapter ("tests/testdata/adapter.tsv", &o, tsv, 4);
+}
+
+static void
+test_slices (const char *path)
+{
+  struct scanner *a;
+  struct scanner *b;
+  const char *p;
+  const char *q;
+  size_t n;
+  size_t m;
+
+  a = scanner_open (path, NULL);
+  b = scanner_new (open (path, O_RDONLY));
+  assert ((a != NULL) && (b != NULL));
+  while (scanner_readslice (a, &p, &n) == 0) {
+    assert (scanner_readslice (b, &q, &m) == 0);
+    assert ((n == m) && (memcmp (p, q, n) == 0));
+    assert (memchr (p, '\n', n) == NULL);
+  }
+  assert (scanner_readslice (b, &q, &m) != 0);
+  scanner_free (a);
+  scanner_free (b);
 }
 
 int
@@ -39,5 +424,27 @@ main (void)
   test ("tests/testdata/scanner_clean.txt");
   test ("tests/testdata/scanner_dirty.txt");
   test ("tests/testdata/scanner_large.txt");
+  test_slices ("tests/testdata/scanner_dirty.txt");
+  test_slices ("tests/testdata/scanner_large.txt");
+#if defined(HAVE_LIBZ)
+  test_compressed ("tests/testdata/scanner_dirty.txt.gz");
+  test_truncated ("tests/testdata/scanner_dirty.txt.gz");
+  test_unsplittable ("tests/testdata/scanner_dirty.txt.gz");
+#endif
+#if defined(HAVE_LIBLZMA)
+  test_compressed ("tests/testdata/scanner_large.txt.xz");
+  test_truncated ("tests/testdata/scanner_large.txt.xz");
+#endif
+  test_tokens ("tests/testdata/scanner_dirty.txt");
+  test_tokens ("tests/testdata/scanner_large.txt");
+  test_ranges ("tests/testdata/corpus.txt");
+  test_ranges ("tests/testdata/scanner_dirty.txt");
+  test_unsplittable ("tests/testdata/adapter.xml");
+  test_unfinished ();
+  test_nonblocking ();
+  test_error ();
+  test_filtered ("tests/testdata/scanner_dirty.txt");
+  test_filtered ("tests/testdata/scanner_large.txt");
+  test_adapters ();
   return EXIT_SUCCESS;
 }
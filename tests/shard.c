@@ -0,0 +1,119 @@
+#include "../src/corpus.h"
+#include "../src/shard.h"
+#include "../src/vocab.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define TEST_PATH "/tmp/shard.bin"
+
+/**
+ * Encodes the lines of path into a shard, n bytes of it get cut off.
+ */
+static void
+write_shard (struct vocab *v, const char *path, size_t cut)
+{
+  char line[1024];
+  char buf[SHARD_MAX (sizeof (line)) + sizeof (struct shard_header)];
+  size_t len = 0;
+  FILE *in;
+  FILE *out;
+
+  in = fopen (path, "r");
+  out = fopen (TEST_PATH, "w");
+  assert ((in != NULL) && (out != NULL));
+  assert (fwrite (buf, 1, shard_header (buf, v), out) == sizeof (struct shard_header));
+  while (fgets (line, sizeof (line), in)) {
+    len = shard_encode (buf, v, line, strlen (line));
+    assert (len <= SHARD_MAX (strlen (line)));
+    assert (fwrite (buf, 1, len, out) == len);
+  }
+  assert (fflush (out) == 0);
+  assert (ftell (out) > (long) cut);
+  assert (ftruncate (fileno (out), ftell (out) - (long) cut) == 0);
+  fclose (out);
+  fclose (in);
+}
+
+/**
+ * Reads the shard in blocks of n sentences, which must produce the words of
+ * the corpus c.
+ */
+static void
+test_read (struct corpus *c, size_t n)
+{
+  struct corpus *d;
+  struct shard *s;
+  size_t l = 0;
+  int r;
+
+  d = corpus_new (c->vocab);
+  s = shard_open (TEST_PATH, c->vocab);
+  assert ((d != NULL) && (s != NULL));
+  do {
+    r = corpus_readshard (d, s, n);
+    assert (r >= 0);
+    assert (d->sentences.len <= n);
+    assert (memcmp (d->words.ptr, c->words.ptr + l, d->words.len * sizeof (size_t)) == 0);
+    l += d->words.len;
+    corpus_clear (d);
+  } while (r == 0);
+  assert (l == c->words.len);
+  shard_free (s);
+  corpus_free (d);
+}
+
+int
+main (void)
+{
+  struct corpus *c;
+  struct corpus *d;
+  struct vocab *v;
+  struct vocab *w;
+  struct shard *s;
+  char buf[64];
+
+  v = vocab_new ();
+  w = vocab_new ();
+  assert ((v != NULL) && (w != NULL));
+  assert (vocab_add (v, "cat") == 0);
+  assert (vocab_add (v, "dog") == 0);
+  assert (vocab_add (v, "frog") == 0);
+  assert (vocab_add (v, "mouse") == 0);
+  assert (vocab_add (w, "cat") == 0);
+
+  /* Sentences with less than two known words get dropped. */
+  assert (shard_encode (buf, v, "cat rabbit", 10) == 0);
+  assert (shard_encode (buf, v, "cat dog\n", 8) == 3);
+  assert (memcmp (buf, "\2\0\1", 3) == 0);
+
+  c = corpus_new (v);
+  assert (c != NULL);
+  assert (corpus_parse (c, "tests/testdata/corpus.txt") == 0);
+  assert (!shard_probe ("tests/testdata/corpus.txt"));
+  write_shard (v, "tests/testdata/corpus.txt", 0);
+  assert (shard_probe (TEST_PATH));
+  test_read (c, 1);
+  test_read (c, 3);
+  test_read (c, SIZE_MAX);
+
+  /* Shards only work with the vocab they were written for. */
+  assert (shard_open (TEST_PATH, w) == NULL);
+
+  /* A truncated shard is an error. */
+  write_shard (v, "tests/testdata/corpus.txt", 1);
+  d = corpus_new (v);
+  s = shard_open (TEST_PATH, v);
+  assert ((d != NULL) && (s != NULL));
+  assert (corpus_readshard (d, s, SIZE_MAX) == -1);
+  shard_free (s);
+  corpus_free (d);
+
+  corpus_free (c);
+  vocab_free (v);
+  vocab_free (w);
+  return EXIT_SUCCESS;
+}
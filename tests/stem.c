@@ -0,0 +1,92 @@
+#include "../src/stem.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+const char *stems[] = {
+  "", "a", "s", "t", "al", "ion", "sens", "hope", "rat", "form", "adopt",
+  "electr", "condit", "vietnam", "homolog", "bowdler", "triplic",
+};
+
+const char *suffixes[] = {
+  "", "s", "es", "ed", "ing", "y", "e", "l", "ational", "tional", "enci",
+  "anci", "izer", "bli", "alli", "entli", "eli", "ousli", "ization", "ation",
+  "ator", "alism", "iveness", "fulness", "ousness", "aliti", "iviti", "biliti",
+  "logi", "icate", "ative", "alize", "iciti", "ical", "ful", "ness", "al",
+  "ance", "ence", "er", "ic", "able", "ible", "ant", "ement", "ment", "ent",
+  "ion", "sion", "tion", "ou", "ism", "ate", "iti", "ous", "ive", "ize",
+};
+
+static void
+check (const char *w)
+{
+  char a[256];
+  char b[256];
+
+  assert (strlen (w) < sizeof (a));
+  strcpy (a, w);
+  strcpy (b, w);
+  assert (stem (a) == stemtab (b));
+  assert (strcmp (a, b) == 0);
+}
+
+/**
+ * Compares both stemmers on every word of the file, reduced to lowercase
+ * letters the way filterword does.
+ */
+static size_t
+test_file (const char *path)
+{
+  char w[256];
+  size_t n = 0;
+  size_t words = 0;
+  FILE *f;
+  int c;
+
+  f = fopen (path, "r");
+  assert (f != NULL);
+  while ((c = fgetc (f)) != EOF) {
+    if ((c >= 'A') && (c <= 'Z'))
+      c += 'a' - 'A';
+    if ((c >= 'a') && (c <= 'z')) {
+      if (n < sizeof (w) - 1)
+        w[n++] = (char) c;
+      continue;
+    }
+    if (n == 0)
+      continue;
+    w[n] = '\0';
+    check (w);
+    words++;
+    n = 0;
+  }
+  fclose (f);
+  return words;
+}
+
+int
+main (void)
+{
+  char w[64];
+  size_t i;
+  size_t j;
+  size_t k;
+
+  /* All suffix combinations, including words that are nothing but suffix. */
+  for (i = 0; i < sizeof (stems) / sizeof (stems[0]); i++) {
+    for (j = 0; j < sizeof (suffixes) / sizeof (suffixes[0]); j++) {
+      for (k = 0; k < sizeof (suffixes) / sizeof (suffixes[0]); k++) {
+        snprintf (w, sizeof (w), "%s%s%s", stems[i], suffixes[j], suffixes[k]);
+        check (w);
+      }
+    }
+  }
+
+  assert (test_file ("tests/testdata/corpus.txt") > 0);
+  assert (test_file ("tests/testdata/scanner_dirty.txt") > 0);
+  assert (test_file ("tests/testdata/scanner_large.txt") > 0);
+  assert (test_file ("tests/testdata/vocab.txt") > 0);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include "../src/stem.h"
+#include "../src/stemcache.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+const char *words[] = {
+  "caresses", "ponies", "ties", "caress", "cats", "feed", "agreed", "plastered",
+  "bled", "motoring", "sing", "conflated", "troubled", "sized", "hopping",
+  "tanned", "falling", "hissing", "fizzed", "failing", "filing", "happy", "sky",
+  "relational", "conditional", "rational", "valenci", "hesitanci", "digitizer",
+  "conformabli", "radicalli", "differentli", "vileli", "analogousli",
+  "vietnamization", "predication", "operator", "feudalism", "decisiveness",
+  "hopefulness", "callousness", "formaliti", "sensitiviti", "sensibiliti",
+  "triplicate", "formative", "formalize", "electriciti", "electrical",
+  "hopeful", "goodness", "revival", "allowance", "inference", "airliner",
+  "gyroscopic", "adjustable", "defensible", "irritant", "replacement",
+  "adjustment", "dependent", "adoption", "homologou", "communism", "activate",
+  "angulariti", "homologous", "effective", "bowdlerize", "probate", "rate",
+  "cease", "controll", "roll", "a", "is", "internationalizations",
+};
+
+int
+main (void)
+{
+  const size_t n = sizeof (words) / sizeof (words[0]);
+  char a[64];
+  char b[64];
+  size_t lookups;
+  size_t hits;
+  size_t i;
+  int r;
+
+  for (r = 0; r < 3; r++) {
+    for (i = 0; i < n; i++) {
+      strcpy (a, words[i]);
+      strcpy (b, words[i]);
+      assert (stemcache_stem (a, strlen (a)) == stem (b));
+      assert (strcmp (a, b) == 0);
+    }
+  }
+  stemcache_flush ();
+  stemcache_stats (&hits, &lookups);
+  assert (lookups > 0);
+  assert (hits > 0);
+  assert (hits < lookups);
+  return EXIT_SUCCESS;
+}
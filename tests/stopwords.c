@@ -0,0 +1,73 @@
+#include "../src/phash.h"
+#include "../src/stopwords.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define stopword(w) \
+  isstopword (w, strlen (w))
+
+static void
+test_builtin (void)
+{
+  char w[256];
+  FILE *f;
+  int n = 0;
+
+  f = fopen ("src/stopwords.txt", "r");
+  assert (f != NULL);
+  while (fgets (w, sizeof (w), f)) {
+    w[strcspn (w, "\n")] = '\0';
+    assert (stopword (w));
+    n++;
+  }
+  fclose (f);
+  assert (n > 200);
+  assert (!stopword (""));
+  assert (!stopword ("cat"));
+  assert (!stopword ("abou"));
+  assert (!stopword ("aboutt"));
+  assert (isstopword ("abouttt", 5));
+}
+
+static void
+test_phash (void)
+{
+  struct phash p;
+  char *words[5000];
+  char w[32];
+  size_t i;
+
+  for (i = 0; i < 5000; i++) {
+    sprintf (w, "w%zu", i * 7);
+    words[i] = strdup (w);
+  }
+  assert (phash_build (&p, (const char *const *) words, 5000) == 0);
+  for (i = 0; i < 5000 * 7; i++) {
+    sprintf (w, "w%zu", i);
+    assert (phash_contains (&p, w, strlen (w)) == ((i % 7) == 0));
+  }
+  phash_free (&p);
+  for (i = 0; i < 5000; i++)
+    free (words[i]);
+}
+
+int
+main (void)
+{
+  test_builtin ();
+  test_phash ();
+
+  assert (stopwords_load ("tests/testdata/stopwords.txt") == 0);
+  assert (stopword ("cat"));
+  assert (stopword ("dog"));
+  assert (stopword ("frogs"));
+  assert (!stopword ("about"));
+  assert (!stopword ("custom"));
+  stopwords_reset ();
+  assert (stopword ("about"));
+  assert (!stopword ("cat"));
+  return EXIT_SUCCESS;
+}
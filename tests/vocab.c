@@ -1,6 +1,9 @@
 #include "../src/vocab.h"
+#include "../src/file.h"
+#include "../src/hash.h"
 
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <assert.h>
@@ -32,6 +35,388 @@ static struct test_vector test_vectors[] = {
 };
 /**INDENT-ON**/
 
+/**
+ * Adds enough words to grow the table a few times, every word must still be
+ * found with its count.
+ */
+static void
+test_grow (void)
+{
+  struct vocab *v;
+  char w[32];
+  size_t n = 300000;
+  size_t i;
+  size_t x;
+
+  v = vocab_new ();
+  assert (v != NULL);
+  for (i = 0; i < n; i++) {
+    snprintf (w, sizeof (w), "w%zx", i * 2654435761u);
+    assert (vocab_add (v, w) == 0);
+    if (i % 3 == 0)
+      assert (vocab_add (v, w) == 0);
+  }
+  assert (v->len == n);
+  for (i = 0; i < n; i++) {
+    snprintf (w, sizeof (w), "w%zx", i * 2654435761u);
+    assert (vocab_find (v, w, &x) == 0);
+    assert (x == i);
+    assert (v->count[x] == 1 + (i % 3 == 0));
+  }
+  assert (vocab_find (v, "missing", &x) != 0);
+  v->min = 2;
+  assert (vocab_shrink (v) == 0);
+  assert (v->len == (n + 2) / 3);
+  for (i = 0; i < n; i++) {
+    snprintf (w, sizeof (w), "w%zx", i * 2654435761u);
+    assert ((vocab_find (v, w, &x) == 0) == (i % 3 == 0));
+  }
+  vocab_free (v);
+}
+
+/**
+ * Adds overlapping ranges of words to v, with counts depending on k.
+ */
+static void
+fill (struct vocab *v, size_t k)
+{
+  char w[32];
+  size_t i;
+  size_t j;
+
+  for (i = k * 7000; i < k * 7000 + 20000; i++) {
+    snprintf (w, sizeof (w), "w%zx", i * 2654435761u);
+    for (j = 0; j <= (i + k) % 3; j++)
+      assert (vocab_add (v, w) == 0);
+  }
+}
+
+/**
+ * A parallel merge must result in the same words, order and counts as
+ * merging the sources one by one.
+ */
+static void
+test_mergeall (size_t jobs)
+{
+  struct vocab *src[5];
+  struct vocab *a;
+  struct vocab *b;
+  size_t i;
+  size_t x;
+
+  a = vocab_new ();
+  b = vocab_new ();
+  assert ((a != NULL) && (b != NULL));
+  fill (a, 1);
+  fill (b, 1);
+  for (i = 0; i < len (src); i++) {
+    src[i] = vocab_new ();
+    assert (src[i] != NULL);
+    fill (src[i], (i * 3) % 5);
+    assert (vocab_merge (a, src[i]) == 0);
+  }
+  assert (vocab_mergeall (b, src, len (src), jobs) == 0);
+  assert (a->len == b->len);
+  for (i = 0; i < a->len; i++) {
+    assert (strcmp (vocab_word (a, i), vocab_word (b, i)) == 0);
+    assert (a->hash[i] == b->hash[i]);
+    assert (a->count[i] == b->count[i]);
+    assert (vocab_find (b, vocab_word (a, i), &x) == 0);
+    assert (x == i);
+  }
+  for (i = 0; i < len (src); i++)
+    vocab_free (src[i]);
+  vocab_free (a);
+  vocab_free (b);
+}
+
+/**
+ * A capped vocab must stay within its limit and keep the true count of every
+ * word within its error bound.
+ */
+static void
+test_prune (void)
+{
+  struct vocab *a;
+  struct vocab *b;
+  char w[32];
+  size_t i;
+  size_t x;
+
+  a = vocab_new ();
+  b = vocab_new ();
+  assert ((a != NULL) && (b != NULL));
+  b->limit = 1000;
+  for (i = 0; i < 200000; i++) {
+    /* Zipf distributed words mixed with a long tail. */
+    x = (i * 2654435761u) % 1000000;
+    if (x % 3)
+      snprintf (w, sizeof (w), "w%zu", 1000000 / (x + 1));
+    else
+      snprintf (w, sizeof (w), "u%zu", x);
+    assert (vocab_add (a, w) == 0);
+    assert (vocab_add (b, w) == 0);
+    assert (b->len <= b->limit);
+  }
+  assert (b->error > 0);
+  for (i = 0; i < a->len; i++) {
+    if (vocab_find (b, vocab_word (a, i), &x) != 0) {
+      assert (a->count[i] <= b->error);
+      continue;
+    }
+    assert (b->count[x] <= a->count[i]);
+    assert (a->count[i] <= b->count[x] + b->error);
+  }
+  vocab_free (a);
+  vocab_free (b);
+}
+
+/**
+ * Pruning must honor the limit even if all counts are past the histogram of
+ * prune, and keep the words with the highest counts.
+ */
+static void
+test_prune_high (void)
+{
+  struct vocab *a;
+  struct vocab *b;
+  char w[32];
+  size_t i;
+  size_t j;
+  size_t x;
+
+  a = vocab_new ();
+  b = vocab_new ();
+  assert ((a != NULL) && (b != NULL));
+  for (i = 0; i < 100; i++) {
+    snprintf (w, sizeof (w), "h%zu", i);
+    for (j = 0; j < 1100 + i * 10; j++)
+      assert (vocab_add (a, w) == 0);
+  }
+  b->limit = 10;
+  assert (vocab_merge (b, a) == 0);
+  assert (b->len == 7);
+  assert (b->error == 1100 + 92 * 10);
+  for (i = 93; i < 100; i++) {
+    snprintf (w, sizeof (w), "h%zu", i);
+    assert (vocab_find (b, w, &x) == 0);
+    assert (b->count[x] == 1100 + i * 10);
+  }
+  for (i = 0; i < 1000; i++) {
+    snprintf (w, sizeof (w), "u%zu", i);
+    assert (vocab_add (b, w) == 0);
+    assert (b->len <= b->limit);
+  }
+  vocab_free (a);
+  vocab_free (b);
+}
+
+struct ref {
+  uint32_t count;
+  size_t index;
+};
+
+static int
+cmp (const void *a, const void *b)
+{
+  const struct ref *x = (const struct ref *) a;
+  const struct ref *y = (const struct ref *) b;
+
+  if (x->count != y->count)
+    return (x->count < y->count) - (x->count > y->count);
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * Shrinking must keep the words with the highest counts that reach min, at
+ * most keep of them, sorted by count with ties in insertion order. Counts
+ * cover all four bytes and have many ties.
+ */
+static void
+test_shrink (size_t min, size_t keep)
+{
+  struct ref r[5000];
+  struct vocab *v;
+  char w[32];
+  size_t n = len (r);
+  size_t i;
+
+  v = vocab_new ();
+  assert (v != NULL);
+  v->min = min;
+  v->keep = keep;
+  for (i = 0; i < n; i++) {
+    snprintf (w, sizeof (w), "w%zu", i);
+    assert (vocab_add (v, w) == 0);
+    r[i].count = (uint32_t) (i * 2654435761u) >> (i % 4 * 8);
+    if (i % 5 == 0)
+      r[i].count %= 7;
+    r[i].index = i;
+    v->count[i] = r[i].count;
+  }
+  qsort (r, n, sizeof (struct ref), cmp);
+  while ((n > 0) && (r[n - 1].count < min))
+    n--;
+  if ((keep > 0) && (n > keep))
+    n = keep;
+
+  assert (vocab_shrink (v) == 0);
+  assert (v->len == n);
+  for (i = 0; i < n; i++) {
+    snprintf (w, sizeof (w), "w%zu", r[i].index);
+    assert (strcmp (vocab_word (v, i), w) == 0);
+    assert (v->count[i] == r[i].count);
+  }
+  vocab_free (v);
+}
+
+/**
+ * Opened vocabs are mapped and get copied once they change. Saving over the
+ * file must not disturb vocabs that still map the old one.
+ */
+static void
+test_mapped (void)
+{
+  struct vocab *v;
+  struct vocab *w;
+  size_t x;
+
+  v = vocab_open ("/tmp/vocab.bin");
+  w = vocab_open ("/tmp/vocab.bin");
+  assert ((v != NULL) && (w != NULL));
+  assert ((v->map.ptr != NULL) && (w->map.ptr != NULL));
+  assert (vocab_find (v, "mouse", &x) == 0);
+  assert (x == 0);
+  assert (vocab_add (v, "mouse") == 0);
+  assert (vocab_add (v, "zebra") == 0);
+  assert (v->map.ptr == NULL);
+  assert (v->count[0] == test_vectors[0].count + 1);
+  assert (vocab_find (v, "zebra", &x) == 0);
+  assert (x == len (test_vectors));
+  assert (vocab_save (v, "/tmp/vocab.bin") == 0);
+  vocab_free (v);
+
+  assert (w->len == len (test_vectors));
+  assert (w->count[0] == test_vectors[0].count);
+  assert (vocab_find (w, "zebra", &x) != 0);
+  vocab_free (w);
+
+  v = vocab_open ("/tmp/vocab.bin");
+  assert (v != NULL);
+  assert (v->len == len (test_vectors) + 1);
+  assert (vocab_find (v, "zebra", &x) == 0);
+  assert (v->count[x] == 1);
+  vocab_free (v);
+}
+
+static int
+compare (const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t *) a;
+  const uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Saved vocabs look words up in their frozen table. Two words with the same
+ * hash must both be found, and words that are missing must not be.
+ */
+static void
+test_frozen (void)
+{
+  const size_t n = 1 << 19;
+  char a[32];
+  char b[32];
+  uint64_t *h;
+  struct vocab *v;
+  size_t i;
+  size_t x;
+
+  h = malloc (n * sizeof (uint64_t));
+  assert (h != NULL);
+  for (i = 0; i < n; i++) {
+    snprintf (a, sizeof (a), "c%zx", i * 2654435761u);
+    h[i] = ((uint64_t) hashptr (a, strlen (a)) << 32) | i;
+  }
+  qsort (h, n, sizeof (uint64_t), compare);
+  for (i = 1; (i < n) && ((h[i] >> 32) != (h[i - 1] >> 32)); i++);
+  assert (i < n);
+  snprintf (a, sizeof (a), "c%zx", (size_t) (h[i - 1] & 0xffffffff) * 2654435761u);
+  snprintf (b, sizeof (b), "c%zx", (size_t) (h[i] & 0xffffffff) * 2654435761u);
+  free (h);
+
+  v = vocab_new ();
+  assert (v != NULL);
+  v->min = 0;
+  fill (v, 0);
+  assert (vocab_add (v, a) == 0);
+  assert (vocab_add (v, b) == 0);
+  assert (vocab_save (v, "/tmp/vocab.bin") == 0);
+  vocab_free (v);
+
+  v = vocab_open ("/tmp/vocab.bin");
+  assert ((v != NULL) && (v->map.ptr != NULL));
+  assert (v->frozen.len > 0);
+  for (i = 0; i < v->len; i++) {
+    assert (vocab_find (v, vocab_word (v, i), &x) == 0);
+    assert (x == i);
+  }
+  assert (vocab_find (v, a, &x) == 0);
+  assert (strcmp (vocab_word (v, x), a) == 0);
+  assert (vocab_find (v, b, &x) == 0);
+  assert (strcmp (vocab_word (v, x), b) == 0);
+  for (i = 0; i < 20000; i++) {
+    snprintf (a, sizeof (a), "x%zx", i);
+    assert (vocab_find (v, a, &x) != 0);
+  }
+
+  /* Changes drop the frozen table. */
+  assert (vocab_add (v, "zebra") == 0);
+  assert (v->frozen.len == 0);
+  assert (vocab_find (v, "zebra", &x) == 0);
+  vocab_free (v);
+}
+
+/**
+ * Files of the old layout hold one record per word.
+ */
+static void
+test_records (void)
+{
+  struct vocab_entry e[len (test_vectors)];
+  struct vocab *v;
+  struct file *f;
+  size_t i;
+  size_t x;
+
+  memset (e, 0, sizeof (e));
+  for (i = 0; i < len (e); i++) {
+    e[i].hash = hashptr (test_vectors[i].word, strlen (test_vectors[i].word));
+    e[i].count = (uint32_t) test_vectors[i].count;
+    e[i].code = test_vectors[i].code;
+    strcpy (e[i].word, test_vectors[i].word);
+  }
+  f = file_create ("/tmp/vocab.bin");
+  assert (f != NULL);
+  f->header.data[0] = len (e);
+  f->header.data[1] = 7;
+  assert (file_write (f, e, sizeof (e)) == 0);
+  file_close (f);
+
+  v = vocab_open ("/tmp/vocab.bin");
+  assert (v != NULL);
+  assert (v->map.ptr == NULL);
+  assert (v->min == 7);
+  assert (v->len == len (e));
+  for (i = 0; i < len (e); i++) {
+    assert (vocab_find (v, test_vectors[i].word, &x) == 0);
+    assert (x == i);
+    assert (v->code[i] == test_vectors[i].code);
+  }
+  vocab_free (v);
+}
+
 int
 main (void)
 {
@@ -48,12 +433,28 @@ main (void)
 
   v = vocab_open ("/tmp/vocab.bin");
   for (i = 0; i < len (test_vectors); i++) {
-    assert (strcmp (v->entries[i].word, test_vectors[i].word) == 0);
-    assert (memcmp (v->entries[i].point, test_vectors[i].point, sizeof (test_vectors[i].point)) == 0);
-    assert (v->entries[i].count == test_vectors[i].count);
-    assert (v->entries[i].code == test_vectors[i].code);
+    assert (strcmp (vocab_word (v, i), test_vectors[i].word) == 0);
+    assert (memcmp (vocab_point (v, i), test_vectors[i].point, sizeof (test_vectors[i].point)) == 0);
+    assert (v->count[i] == test_vectors[i].count);
+    assert (v->code[i] == test_vectors[i].code);
   }
   vocab_free (v);
 
+  test_mapped ();
+  test_records ();
+  test_frozen ();
+  test_grow ();
+  test_mergeall (1);
+  test_mergeall (3);
+  test_mergeall (8);
+  test_prune ();
+  test_prune_high ();
+  test_shrink (0, 0);
+  test_shrink (3, 0);
+  test_shrink (0, 1);
+  test_shrink (0, 1000);
+  test_shrink (0, 4500);
+  test_shrink (5, 4500);
+  test_shrink (5, 10000);
   return EXIT_SUCCESS;
 }